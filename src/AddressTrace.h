@@ -0,0 +1,158 @@
+#ifndef ADDRESS_TRACE_H
+#define ADDRESS_TRACE_H
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <errno.h>
+#include <vector>
+
+// Binary trace of cache accesses: a TraceHeader followed by one fixed-size
+// TraceRecord per access, both in the byte order of the machine that wrote
+// them. Written by cycle_sim and sim, replayed by cache_sim.
+#define TRACE_MAGIC 0x5452434d
+#define TRACE_VERSION 1
+
+// TraceRecord::flags
+#define TRACE_WRITE 0x1
+#define TRACE_ICACHE 0x2
+
+// Records moved per fread/fwrite
+#define TRACE_BUFFER_RECORDS 65536
+
+struct TraceHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t recordSize;
+    uint32_t reserved;
+};
+
+struct TraceRecord
+{
+    uint32_t address;
+    //Address of the instruction making the access.
+    uint32_t pc;
+    //Cycle (or instruction count, for sim) of the access.
+    uint32_t cycle;
+    //Access size in bytes.
+    uint8_t size;
+    uint8_t flags;
+    uint16_t reserved;
+};
+
+struct TraceWriter {
+  FILE *file;
+  std::vector<TraceRecord> buffer;
+  uint32_t used;
+
+  TraceWriter() : file(NULL), used(0) {}
+
+  // Creates the trace file and writes its header. Returns 0 or -errno.
+  int open(const char *path) {
+    close();
+    file = fopen(path, "wb");
+    if (!file) {
+      return -errno;
+    }
+    TraceHeader header = {TRACE_MAGIC, TRACE_VERSION, sizeof(TraceRecord), 0};
+    fwrite(&header, sizeof(header), 1, file);
+    buffer.resize(TRACE_BUFFER_RECORDS);
+    used = 0;
+    return 0;
+  }
+
+  bool isOpen() const {
+    return file != NULL;
+  }
+
+  void record(uint32_t address, uint32_t size, bool isRead, bool isICache, uint32_t pc, uint32_t cycle) {
+    TraceRecord & r = buffer[used];
+    r.address = address;
+    r.pc = pc;
+    r.cycle = cycle;
+    r.size = size;
+    r.flags = (isRead ? 0 : TRACE_WRITE) | (isICache ? TRACE_ICACHE : 0);
+    r.reserved = 0;
+    if (++used == buffer.size()) {
+      flush();
+    }
+  }
+
+  void flush() {
+    fwrite(&buffer[0], sizeof(TraceRecord), used, file);
+    used = 0;
+  }
+
+  void close() {
+    if (!file) {
+      return;
+    }
+    flush();
+    fclose(file);
+    file = NULL;
+  }
+
+  ~TraceWriter() {
+    close();
+  }
+};
+
+struct TraceReader {
+  FILE *file;
+  std::vector<TraceRecord> buffer;
+
+  TraceReader() : file(NULL) {}
+
+  // Opens a trace and checks its header. Returns 0, -errno, or -EINVAL if
+  // the file is not a trace this build can read.
+  int open(const char *path) {
+    close();
+    file = fopen(path, "rb");
+    if (!file) {
+      return -errno;
+    }
+    TraceHeader header;
+    if (fread(&header, sizeof(header), 1, file) != 1 || header.magic != TRACE_MAGIC ||
+        header.version != TRACE_VERSION || header.recordSize != sizeof(TraceRecord)) {
+      close();
+      return -EINVAL;
+    }
+    buffer.resize(TRACE_BUFFER_RECORDS);
+    return 0;
+  }
+
+  // Points records at the next batch and returns its length, 0 at the end
+  uint32_t read(const TraceRecord *& records) {
+    records = &buffer[0];
+    return fread(&buffer[0], sizeof(TraceRecord), buffer.size(), file);
+  }
+
+  void close() {
+    if (file) {
+      fclose(file);
+      file = NULL;
+    }
+  }
+
+  ~TraceReader() {
+    close();
+  }
+};
+
+// Reads a whole trace into records. Returns 0 or the error from open().
+static inline int loadTrace(const char *path, std::vector<TraceRecord> & records) {
+  TraceReader trace;
+  int ret = trace.open(path);
+  if (ret) {
+    return ret;
+  }
+  records.clear();
+  const TraceRecord *batch;
+  uint32_t n;
+  while ((n = trace.read(batch)) > 0) {
+    records.insert(records.end(), batch, batch + n);
+  }
+  return 0;
+}
+
+#endif
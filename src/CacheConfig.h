@@ -1,9 +1,64 @@
+#ifndef CACHE_CONFIG_H
+#define CACHE_CONFIG_H
+
 #include <inttypes.h>
 
 enum CacheType
 {
     DIRECT_MAPPED,
-    TWO_WAY_SET_ASSOC
+    TWO_WAY_SET_ASSOC,
+    N_WAY_SET_ASSOC,
+    FULLY_ASSOC
+};
+
+enum ReplacementPolicy
+{
+    REPL_LRU,
+    REPL_TREE_PLRU,
+    REPL_SRRIP,
+    REPL_BRRIP,
+    REPL_FIFO,
+    REPL_RANDOM
+};
+
+enum WritePolicy
+{
+    WRITE_BACK,
+    WRITE_THROUGH
+};
+
+enum WriteMissPolicy
+{
+    WRITE_ALLOCATE,
+    NO_WRITE_ALLOCATE
+};
+
+enum InclusionPolicy
+{
+    NON_INCLUSIVE,
+    INCLUSIVE
+};
+
+enum PrefetchPolicy
+{
+    PREFETCH_NONE,
+    PREFETCH_NEXT_LINE,
+    PREFETCH_STRIDE,
+    PREFETCH_STREAM
+};
+
+enum RefillPolicy
+{
+    REFILL_WHOLE_BLOCK,
+    REFILL_EARLY_RESTART,
+    REFILL_CRITICAL_WORD_FIRST
+};
+
+enum WayPrediction
+{
+    WAY_PREDICT_NONE,
+    WAY_PREDICT_MRU,
+    WAY_PREDICT_PC
 };
 
 struct CacheConfig
@@ -12,8 +67,74 @@ struct CacheConfig
     uint32_t cacheSize;
     //Cache block size in bytes.
     uint32_t blockSize;
-    //Type of cache - direct-mapped or two-way set-assoc?
+    //Type of cache - direct-mapped, two-way, N-way or fully associative?
     CacheType type;
     //Miss latency in cycles.
     uint32_t missLatency;
+    //Number of ways (a power of two) for N_WAY_SET_ASSOC caches.
+    uint32_t associativity = 1;
+    //Which line of a set to replace on a miss.
+    ReplacementPolicy replacement = REPL_LRU;
+    //Seed for REPL_RANDOM and for BRRIP's insertion choice.
+    uint32_t replacementSeed = 1;
+    //Write-back (dirty lines written on eviction) or write-through?
+    WritePolicy writePolicy = WRITE_BACK;
+    //Does a store miss bring the block into the cache?
+    WriteMissPolicy writeMissPolicy = WRITE_ALLOCATE;
+    //Cycles to return a block when this cache serves the level above it (an L2).
+    uint32_t hitLatency = 0;
+    //Must every block cached above this level also be held here?
+    InclusionPolicy inclusion = NON_INCLUSIVE;
+    //Entries in the fully-associative victim buffer (0 disables it).
+    uint32_t victimEntries = 0;
+    //Stall cycles for a miss served from the victim buffer.
+    uint32_t victimLatency = 1;
+    //Hardware prefetcher feeding this cache.
+    PrefetchPolicy prefetcher = PREFETCH_NONE;
+    //Blocks fetched ahead per trigger (N for next-N-line, depth otherwise).
+    uint32_t prefetchDegree = 1;
+    //Entries in the stride table, or number of stream buffers (at least 1).
+    uint32_t prefetchEntries = 16;
+    //Miss status holding registers. 0 keeps the cache blocking; otherwise the
+    //pipeline runs on under up to this many outstanding dCache misses.
+    uint32_t mshrs = 0;
+    //Classify misses as compulsory, capacity or conflict (or sector, when the
+    //tag was held) and count activity per set. Costs a shadow
+    //fully-associative cache on every access.
+    bool profileMisses = false;
+    //Record LRU stack distances of this cache's accesses up to this many ways
+    //(0 disables), giving the hit ratio of every power-of-two size and
+    //associativity at this block size from one run.
+    uint32_t stackDistanceWays = 0;
+    //Bytes moved per bus beat on a refill. 0 moves the whole block in
+    //missLatency; otherwise missLatency is the wait for the first beat.
+    uint32_t busWidth = 0;
+    //Cycles each further beat of a refill takes.
+    uint32_t beatLatency = 1;
+    //Whether a refill resumes the pipeline once the whole block is in, or
+    //once the requested word is (early restart), optionally fetching that
+    //word's beat first (critical word first).
+    RefillPolicy refill = REFILL_WHOLE_BLOCK;
+    //Line-sized entries in the coalescing write buffer that store misses
+    //retire into (0 disables it). Entries drain one at a time while the
+    //pipeline runs on.
+    uint32_t writeBufferEntries = 0;
+    //Way predictor for set-associative caches: the most recently used way of
+    //each set, or the last way each load/store PC hit in. A correctly
+    //predicted hit costs what a direct-mapped hit does.
+    WayPrediction wayPrediction = WAY_PREDICT_NONE;
+    //Entries in the PC-indexed way prediction table.
+    uint32_t wayPredictorEntries = 64;
+    //Extra stall cycles for a hit in a way other than the predicted one.
+    uint32_t wayMispredictPenalty = 1;
+    //Bytes per sector, a power of two from a word up to the block size, and
+    //no smaller than a 32nd of the block.
+    //Sectored lines keep one tag but valid and dirty bits per sector, and a
+    //miss fetches only the sectors it needs. 0 keeps lines whole.
+    uint32_t sectorSize = 0;
+    //Stall cycles for a store to a Shared line to invalidate the copies in
+    //the other cores' dCaches (multicore runs only).
+    uint32_t upgradeLatency = 1;
 };
+
+#endif
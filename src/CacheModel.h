@@ -0,0 +1,2249 @@
+#ifndef CACHE_MODEL_H
+#define CACHE_MODEL_H
+
+#include <inttypes.h>
+#include <math.h>
+#include <errno.h>
+#include <vector>
+#include <algorithm>
+#include <ostream>
+#include <fstream>
+#include <map>
+#include <functional>
+#include <mutex>
+#include "MemoryStore.h"
+#include "CacheConfig.h"
+#include "StackDistance.h"
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+// Flags packed above the tag in each metadata word
+#define LINE_VALID 0x80000000
+#define LINE_DIRTY 0x40000000
+// Brought in by a prefetcher and not yet used by a demand access
+#define LINE_PREFETCHED 0x20000000
+// Another core's dCache may hold a copy (MESI Shared)
+#define LINE_SHARED 0x10000000
+#define LINE_TAG   0x00ffffff
+// Bits that must match for a lookup to hit
+#define LINE_KEY   (LINE_VALID | LINE_TAG)
+// End of the shadow LRU list
+#define SHADOW_NONE 0xffffffff
+
+// Number of ways in each set for a config
+static inline uint32_t cacheWays(CacheConfig & config) {
+  switch (config.type) {
+    case DIRECT_MAPPED:
+      return 1;
+    case TWO_WAY_SET_ASSOC:
+      return 2;
+    case N_WAY_SET_ASSOC:
+      return config.associativity;
+    case FULLY_ASSOC:
+      return config.cacheSize / config.blockSize;
+  }
+  return 1;
+}
+
+static inline bool isPowerOfTwo(uint32_t x) {
+  return x && !(x & (x - 1));
+}
+
+// Checks that a config describes a cache init can build: power-of-two sizes
+// and ways, at least one set, and sectors and bus beats that divide the
+// block. Returns 0, or -EINVAL.
+static inline int checkCacheConfig(CacheConfig & config) {
+  if (!isPowerOfTwo(config.cacheSize) || !isPowerOfTwo(config.blockSize) || config.blockSize < WORD_SIZE) {
+    return -EINVAL;
+  }
+  if (config.type == N_WAY_SET_ASSOC && !isPowerOfTwo(config.associativity)) {
+    return -EINVAL;
+  }
+  if ((uint64_t)cacheWays(config) * config.blockSize > config.cacheSize) {
+    return -EINVAL;
+  }
+  // The sector masks have a bit per sector, so a block has at most 32
+  if (config.sectorSize && (!isPowerOfTwo(config.sectorSize) || config.sectorSize < WORD_SIZE ||
+                            config.sectorSize > config.blockSize || config.blockSize / config.sectorSize > 32)) {
+    return -EINVAL;
+  }
+  if (config.busWidth && config.blockSize % config.busWidth) {
+    return -EINVAL;
+  }
+  return 0;
+}
+
+static inline const char *replacementName(ReplacementPolicy policy) {
+  switch (policy) {
+    case REPL_LRU:
+      return "LRU";
+    case REPL_TREE_PLRU:
+      return "tree-PLRU";
+    case REPL_SRRIP:
+      return "SRRIP";
+    case REPL_BRRIP:
+      return "BRRIP";
+    case REPL_FIFO:
+      return "FIFO";
+    case REPL_RANDOM:
+      return "random";
+  }
+  return "unknown";
+}
+
+static inline const char *refillName(RefillPolicy refill) {
+  switch (refill) {
+    case REFILL_WHOLE_BLOCK:
+      return "whole block";
+    case REFILL_EARLY_RESTART:
+      return "early restart";
+    case REFILL_CRITICAL_WORD_FIRST:
+      return "critical word first";
+  }
+  return "unknown";
+}
+
+static inline const char *prefetcherName(PrefetchPolicy prefetcher) {
+  switch (prefetcher) {
+    case PREFETCH_NONE:
+      return "none";
+    case PREFETCH_NEXT_LINE:
+      return "next-line";
+    case PREFETCH_STRIDE:
+      return "stride";
+    case PREFETCH_STREAM:
+      return "stream";
+  }
+  return "unknown";
+}
+
+static inline const char *wayPredictionName(WayPrediction prediction) {
+  switch (prediction) {
+    case WAY_PREDICT_NONE:
+      return "none";
+    case WAY_PREDICT_MRU:
+      return "MRU";
+    case WAY_PREDICT_PC:
+      return "PC";
+  }
+  return "unknown";
+}
+
+// Stores to one block waiting in the write buffer. mask has the bits of each
+// word that were written, and the entry is done draining at readyAt.
+struct WriteBufferEntry {
+  uint32_t block;
+  uint32_t readyAt;
+  std::vector<uint32_t> data;
+  std::vector<uint32_t> mask;
+};
+
+// One row of the PC-indexed stride table
+struct StrideEntry {
+  uint32_t pc;
+  uint32_t lastAddress;
+  int32_t stride;
+  // Saturating count of repeats of the same stride
+  uint32_t confidence;
+};
+
+// Represents a cache as flat arrays. Line i (= set * ways + way) keeps its tag
+// and flags in meta[i], its block in data[i << block_bits ...] and its
+// replacement state (age, RRPV, tree bit...) in repl[i], so a lookup only
+// touches the few metadata words of one set.
+struct Cache {
+  std::vector<uint32_t> meta;
+  std::vector<uint32_t> data;
+  std::vector<uint32_t> repl;
+
+  uint32_t tag_bits;
+  uint32_t index_bits;
+  uint32_t block_bits;
+  uint32_t way_bits;
+  uint32_t ways;
+  // Address decoding constants derived from the bit widths above
+  uint32_t index_shift;
+  uint32_t index_mask;
+  uint32_t tag_shift;
+  uint32_t offset_mask;
+  bool isiCache;
+  uint32_t missLatency;
+  bool isDirect;
+  MemoryStore *mem;
+  // How whole blocks move to and from mem
+  BlockReadFn memRead;
+  BlockWriteFn memWrite;
+  // Next level down (NULL means misses go to mem), and the caches above this
+  // one that an inclusive level back-invalidates when it evicts
+  Cache *next;
+  std::vector<Cache *> uppers;
+  bool inclusive;
+  uint32_t hitLatency;
+  // Stall cycles the last access cost beyond a hit in this cache
+  uint32_t penalty;
+
+  ReplacementPolicy policy;
+  WritePolicy writePolicy;
+  WriteMissPolicy writeMissPolicy;
+  // Access counter used as a timestamp by LRU and FIFO
+  uint32_t clock;
+  // xorshift state for random replacement and BRRIP insertion
+  uint32_t rng;
+
+  uint32_t hits;
+  uint32_t misses;
+  uint32_t evictions;
+  // Dirty lines written back, and bytes moved to and from memory
+  uint32_t writeBacks;
+  uint32_t bytesRead;
+  uint32_t bytesWritten;
+  // Lines invalidated in the levels above to keep an inclusive level inclusive
+  uint32_t backInvalidations;
+
+  // Small fully-associative buffer catching lines evicted from this cache.
+  // Entry e keeps a block number and flags in victimMeta[e], the block in
+  // victimData[e << block_bits ...] and its last use in victimAge[e].
+  std::vector<uint32_t> victimMeta;
+  std::vector<uint32_t> victimData;
+  std::vector<uint32_t> victimAge;
+  uint32_t victimLatency;
+  // Misses served from the victim buffer instead of the next level
+  uint32_t victimHits;
+
+  // Cycle and instruction address of the current access. The caller sets
+  // these before access() so prefetches can be timed and the stride table
+  // trained.
+  uint32_t now;
+  uint32_t pc;
+
+  PrefetchPolicy prefetcher;
+  uint32_t prefetchDegree;
+  // Cycle each prefetched line's data arrives, per line
+  std::vector<uint32_t> readyAt;
+  std::vector<StrideEntry> strides;
+  // Stream buffer b holds its next blocks in order in entries
+  // [b * prefetchDegree, (b + 1) * prefetchDegree), laid out like the victim
+  // buffer, and fetches from block streamNext[b] onwards as it drains
+  std::vector<uint32_t> streamMeta;
+  std::vector<uint32_t> streamData;
+  std::vector<uint32_t> streamReady;
+  std::vector<uint32_t> streamNext;
+  std::vector<uint32_t> streamAge;
+  // Stream buffer to top up after the current access, or -1
+  int pendingStream;
+  // Blocks fetched ahead, those a demand access then used, and those used
+  // before their data had arrived
+  uint32_t prefetches;
+  uint32_t usefulPrefetches;
+  uint32_t latePrefetches;
+
+  // Undo log of the lines and victim entries changed since the last commit(),
+  // oldest first. A record is the index (victim entries come after the
+  // lines), the old meta word and the old block. Only what writeBackAll()
+  // reads is logged.
+  bool journaling;
+  std::vector<uint32_t> journal;
+
+  // Miss classification, kept only if the config asks for it. seenBlocks
+  // stands in for an infinite cache, and a list threaded through
+  // shadowPrev/shadowNext by block number for a fully-associative LRU cache
+  // with as many lines as this one. A miss is compulsory if the block was
+  // never touched, an invalidation miss if a level below back-invalidated it,
+  // conflict if the fully-associative cache would have hit, and capacity
+  // otherwise.
+  bool profiling;
+  std::vector<uint8_t> seenBlocks;
+  std::vector<uint8_t> shadowHeld;
+  std::vector<uint32_t> shadowPrev;
+  std::vector<uint32_t> shadowNext;
+  uint32_t shadowHead;
+  uint32_t shadowTail;
+  uint32_t shadowCount;
+  uint32_t compulsoryMisses;
+  uint32_t capacityMisses;
+  uint32_t conflictMisses;
+  uint32_t invalidationMisses;
+  std::vector<uint32_t> setHits;
+  std::vector<uint32_t> setMisses;
+  std::vector<uint32_t> setEvictions;
+  // Block that last evicted each block (plus one, 0 if none, SHADOW_NONE if
+  // back-invalidated), and how many conflict misses each (missed block,
+  // evicting block) pair caused
+  std::vector<uint32_t> evictedBy;
+  std::map<std::pair<uint32_t, uint32_t>, uint32_t> conflictPairs;
+  // Stack distances of the demand accesses, off unless configured
+  StackDistance stackDistance;
+
+  // Refill bus to the next level: bytes and cycles per beat (busWidth 0
+  // moves a block at once), and the beat order. The bus is busy until
+  // busFreeAt. refillLine is the line of the last demand refill (or -1),
+  // whose beats arrive every beatLatency cycles from refillStart, starting
+  // with beat refillFirstBeat.
+  uint32_t busWidth;
+  uint32_t beatLatency;
+  RefillPolicy refill;
+  uint32_t busFreeAt;
+  int refillLine;
+  uint32_t refillStart;
+  uint32_t refillFirstBeat;
+  // Cycles spent waiting for the bus, and stall cycles early restart saved
+  uint32_t busWaitCycles;
+  uint32_t earlyRestartSaved;
+
+  // Coalescing write buffer, oldest entry first, holding at most one entry
+  // per block. Store misses, and stores to a block already buffered, go here
+  // instead of stalling, and loads read buffered bytes from it. Entries are
+  // applied lazily once their drain time has passed. committedWriteBuffer
+  // is its copy as of the last commit(), taken only if it changed.
+  uint32_t writeBufferEntries;
+  std::vector<WriteBufferEntry> writeBuffer;
+  std::vector<WriteBufferEntry> committedWriteBuffer;
+  bool writeBufferChanged;
+  uint32_t bufferedStores;
+  uint32_t coalescedStores;
+  uint32_t drains;
+  uint32_t forwardedLoads;
+  uint32_t bufferFullStalls;
+
+  // Way predicted for each set (MRU) or each PC slot, probed before the
+  // rest of the set. Only hits are scored, as a miss probes every way anyway.
+  WayPrediction wayPrediction;
+  std::vector<uint16_t> predictedWay;
+  uint32_t wayMispredictPenalty;
+  uint32_t wayPredictedHits;
+  uint32_t wayMispredictedHits;
+
+  // Sectored lines: a sector is 1 << sector_bits words, and sectorValid[i]
+  // and sectorDirty[i] have a bit per sector of line i. sectors is 0 when
+  // lines are whole. LINE_VALID and LINE_DIRTY still describe the line as a
+  // whole, so a line can hold its tag with some sectors missing.
+  uint32_t sectors;
+  uint32_t sector_bits;
+  uint32_t allSectors;
+  std::vector<uint32_t> sectorValid;
+  std::vector<uint32_t> sectorDirty;
+  // Sectors the next fill() or locate() must bring in. Reset to all of them
+  // after each.
+  uint32_t fillSectors;
+  // Accesses finding the tag but not the sector they needed
+  uint32_t sectorMisses;
+
+  // The other cores' dCaches, kept coherent with this one by snooping (MESI).
+  // A valid line is Modified when dirty, Shared when LINE_SHARED is set and
+  // Exclusive otherwise. Empty on a single core.
+  std::vector<Cache *> peers;
+  uint32_t upgradeLatency;
+  // Set before fill() for a block about to be written, so the peers drop
+  // their copies rather than share them
+  bool fillExclusive;
+  // Blocks a peer's write took from this cache, by block number
+  std::vector<uint8_t> lostToPeer;
+  // Misses on blocks lost that way, stores to Shared lines, copies dropped
+  // in peers and here, and Modified lines written back for a peer
+  uint32_t coherenceMisses;
+  uint32_t upgrades;
+  uint32_t invalidationsSent;
+  uint32_t invalidationsReceived;
+  uint32_t interventions;
+  // Accesses that had to take the bus, rather than hitting locally
+  uint32_t busAccesses;
+  // Held by whoever is accessing or snooping this cache on a multicore run,
+  // and this cache's place among its peers in the order the locks are taken
+  std::mutex lock;
+  uint32_t coreIndex;
+
+  // Moves blocks to and from mem with read and write; NULL picks the
+  // word-by-word default
+  void setBlockTransfer(BlockReadFn read, BlockWriteFn write) {
+    memRead = read ? read : wordBlockRead;
+    memWrite = write ? write : wordBlockWrite;
+  }
+
+  // Sizes the arrays from the config and invalidates every line. The config
+  // must pass checkCacheConfig.
+  void init(CacheConfig & config, bool isICache, MemoryStore *mainMem) {
+    ways = cacheWays(config);
+    uint32_t index_size = config.cacheSize / (config.blockSize * ways);
+    uint32_t block_words = config.blockSize / WORD_SIZE;
+
+    index_bits = log2(index_size);
+    block_bits = log2(block_words);
+    way_bits = log2(ways);
+    tag_bits = 16 - index_bits - block_bits - 2;
+    index_shift = block_bits + 2;
+    index_mask = (1 << index_bits) - 1;
+    tag_shift = block_bits + index_bits + 2;
+    offset_mask = (1 << block_bits) - 1;
+    isiCache = isICache;
+    missLatency = config.missLatency;
+    isDirect = (ways == 1);
+    mem = mainMem;
+    setBlockTransfer(NULL, NULL);
+    next = NULL;
+    uppers.clear();
+    inclusive = (config.inclusion == INCLUSIVE);
+    hitLatency = config.hitLatency;
+    penalty = 0;
+    policy = config.replacement;
+    writePolicy = config.writePolicy;
+    writeMissPolicy = config.writeMissPolicy;
+    clock = 0;
+    rng = config.replacementSeed ? config.replacementSeed : 1;
+    hits = 0;
+    misses = 0;
+    evictions = 0;
+    writeBacks = 0;
+    bytesRead = 0;
+    bytesWritten = 0;
+    backInvalidations = 0;
+    victimLatency = config.victimLatency;
+    victimHits = 0;
+
+    meta.assign(index_size * ways, 0);
+    data.assign((index_size * ways) << block_bits, 0);
+    repl.assign(index_size * ways, 0);
+    victimMeta.assign(config.victimEntries, 0);
+    victimData.assign(config.victimEntries << block_bits, 0);
+    victimAge.assign(config.victimEntries, 0);
+
+    uint32_t sector_words = block_words;
+    if (config.sectorSize >= WORD_SIZE && config.sectorSize < config.blockSize) {
+      sector_words = config.sectorSize / WORD_SIZE;
+    }
+    sector_bits = log2(sector_words);
+    sectors = (sector_words < block_words) ? block_words / sector_words : 0;
+    allSectors = sectors ? (2u << (sectors - 1)) - 1 : 0;
+    sectorValid.assign(sectors ? index_size * ways : 0, 0);
+    sectorDirty.assign(sectors ? index_size * ways : 0, 0);
+    fillSectors = allSectors;
+    sectorMisses = 0;
+
+    peers.clear();
+    upgradeLatency = config.upgradeLatency;
+    fillExclusive = false;
+    lostToPeer.clear();
+    coherenceMisses = 0;
+    upgrades = 0;
+    invalidationsSent = 0;
+    invalidationsReceived = 0;
+    interventions = 0;
+    busAccesses = 0;
+    coreIndex = 0;
+
+    now = 0;
+    pc = 0;
+    prefetcher = config.prefetcher;
+    prefetchDegree = config.prefetchDegree ? config.prefetchDegree : 1;
+    uint32_t entries = config.prefetchEntries ? config.prefetchEntries : 1;
+    prefetches = 0;
+    usefulPrefetches = 0;
+    latePrefetches = 0;
+    uint32_t streams = (prefetcher == PREFETCH_STREAM) ? entries : 0;
+    readyAt.assign((prefetcher == PREFETCH_NONE) ? 0 : index_size * ways, 0);
+    strides.assign((prefetcher == PREFETCH_STRIDE) ? entries : 0, StrideEntry());
+    streamMeta.assign(streams * prefetchDegree, 0);
+    streamData.assign((streams * prefetchDegree) << block_bits, 0);
+    streamReady.assign(streams * prefetchDegree, 0);
+    streamNext.assign(streams, 0);
+    streamAge.assign(streams, 0);
+    pendingStream = -1;
+    journaling = false;
+    journal.clear();
+
+    profiling = config.profileMisses;
+    uint32_t blocks = profiling ? MEMORY_SIZE / config.blockSize : 0;
+    seenBlocks.assign(blocks, 0);
+    shadowHeld.assign(blocks, 0);
+    shadowPrev.assign(blocks, SHADOW_NONE);
+    shadowNext.assign(blocks, SHADOW_NONE);
+    shadowHead = SHADOW_NONE;
+    shadowTail = SHADOW_NONE;
+    shadowCount = 0;
+    compulsoryMisses = 0;
+    capacityMisses = 0;
+    conflictMisses = 0;
+    invalidationMisses = 0;
+    setHits.assign(profiling ? index_size : 0, 0);
+    setMisses.assign(profiling ? index_size : 0, 0);
+    setEvictions.assign(profiling ? index_size : 0, 0);
+    evictedBy.assign(blocks, 0);
+    conflictPairs.clear();
+    stackDistance.init(config.blockSize, config.stackDistanceWays);
+
+    busWidth = config.busWidth;
+    beatLatency = config.beatLatency;
+    refill = config.refill;
+    busFreeAt = 0;
+    refillLine = -1;
+    refillStart = 0;
+    refillFirstBeat = 0;
+    busWaitCycles = 0;
+    earlyRestartSaved = 0;
+
+    writeBufferEntries = config.writeBufferEntries;
+    writeBuffer.clear();
+    committedWriteBuffer.clear();
+    writeBufferChanged = false;
+    bufferedStores = 0;
+    coalescedStores = 0;
+    drains = 0;
+    forwardedLoads = 0;
+    bufferFullStalls = 0;
+
+    wayPrediction = isDirect ? WAY_PREDICT_NONE : config.wayPrediction;
+    uint32_t slots = 0;
+    if (wayPrediction == WAY_PREDICT_MRU) {
+      slots = index_size;
+    } else if (wayPrediction == WAY_PREDICT_PC) {
+      slots = config.wayPredictorEntries ? config.wayPredictorEntries : 1;
+    }
+    predictedWay.assign(slots, 0);
+    wayMispredictPenalty = config.wayMispredictPenalty;
+    wayPredictedHits = 0;
+    wayMispredictedHits = 0;
+  }
+
+  uint32_t numLines() const {
+    return meta.size();
+  }
+
+  uint32_t *line(uint32_t i) {
+    return &data[i << block_bits];
+  }
+
+  bool isValid(uint32_t i) const {
+    return meta[i] & LINE_VALID;
+  }
+
+  bool isDirty(uint32_t i) const {
+    return meta[i] & LINE_DIRTY;
+  }
+
+  uint32_t blockBytes() const {
+    return WORD_SIZE << block_bits;
+  }
+
+  // Address of the first word of the block held in line i
+  uint32_t blockAddress(uint32_t i) const {
+    uint32_t first_block_address = (meta[i] & LINE_TAG) << index_bits;
+    first_block_address |= (i >> way_bits);
+    return first_block_address << (block_bits + 2);
+  }
+
+  // Sectors covering words [word, word + nWords) of a block
+  uint32_t sectorsOf(uint32_t word, uint32_t nWords) const {
+    uint32_t first = word >> sector_bits;
+    uint32_t last = (word + nWords - 1) >> sector_bits;
+    return ((2u << (last - first)) - 1) << first;
+  }
+
+  // Sectors wholly inside words [word, word + nWords) of a block
+  uint32_t sectorsWithin(uint32_t word, uint32_t nWords) const {
+    uint32_t first = (word + (1 << sector_bits) - 1) >> sector_bits;
+    uint32_t end = (word + nWords) >> sector_bits;
+    return (end > first) ? sectorsOf(first << sector_bits, (end - first) << sector_bits) : 0;
+  }
+
+  // Whether line i (-1 for none) holds the given word of its block
+  bool holdsWord(int i, uint32_t word) const {
+    return i >= 0 && (!sectors || ((sectorValid[i] >> (word >> sector_bits)) & 1));
+  }
+
+  // Whether the word at memAddress is in the cache proper
+  bool holds(uint32_t memAddress) const {
+    int i = find((memAddress >> index_shift) & index_mask, (memAddress >> tag_shift) & LINE_TAG);
+    return holdsWord(i, (memAddress >> 2) & offset_mask);
+  }
+
+  // Returns the line in the set holding the tag, or -1 on a miss. Sets of four
+  // or more ways compare every tag in the set at once.
+  int find(uint32_t set, uint32_t tag) const {
+    uint32_t base = set << way_bits;
+    const uint32_t *set_meta = &meta[base];
+    uint32_t key = LINE_VALID | tag;
+    uint32_t way = 0;
+
+#if defined(__AVX2__)
+    if (ways >= 8) {
+      __m256i key8 = _mm256_set1_epi32(key);
+      __m256i mask8 = _mm256_set1_epi32(LINE_KEY);
+      for (; way < ways; way += 8) {
+        __m256i m = _mm256_loadu_si256((const __m256i *)(set_meta + way));
+        __m256i eq = _mm256_cmpeq_epi32(_mm256_and_si256(m, mask8), key8);
+        int bits = _mm256_movemask_ps(_mm256_castsi256_ps(eq));
+        if (bits) {
+          return base + way + __builtin_ctz(bits);
+        }
+      }
+      return -1;
+    }
+#endif
+#if defined(__SSE2__)
+    if (ways >= 4) {
+      __m128i key4 = _mm_set1_epi32(key);
+      __m128i mask4 = _mm_set1_epi32(LINE_KEY);
+      for (; way < ways; way += 4) {
+        __m128i m = _mm_loadu_si128((const __m128i *)(set_meta + way));
+        __m128i eq = _mm_cmpeq_epi32(_mm_and_si128(m, mask4), key4);
+        int bits = _mm_movemask_ps(_mm_castsi128_ps(eq));
+        if (bits) {
+          return base + way + __builtin_ctz(bits);
+        }
+      }
+      return -1;
+    }
+#endif
+    for (; way < ways; way++) {
+      if ((set_meta[way] & LINE_KEY) == key) {
+        return base + way;
+      }
+    }
+    return -1;
+  }
+
+  // Returns an invalid line in the set, or -1 if the set is full
+  int findInvalid(uint32_t set) const {
+    uint32_t base = set << way_bits;
+    for (uint32_t way = 0; way < ways; way++) {
+      if (!(meta[base + way] & LINE_VALID)) {
+        return base + way;
+      }
+    }
+    return -1;
+  }
+
+  uint32_t nextRandom() {
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return rng;
+  }
+
+  // Whether an access can finish inside this cache with no bus traffic: a
+  // read of a word held here, or a write to a line held Exclusive or
+  // Modified. A prefetcher or write-through would go to memory.
+  bool hitsLocally(uint32_t memAddress, bool isRead) const {
+    if (prefetcher != PREFETCH_NONE || (!isRead && writePolicy == WRITE_THROUGH)) {
+      return false;
+    }
+    int i = find((memAddress >> index_shift) & index_mask, (memAddress >> tag_shift) & LINE_TAG);
+    return holdsWord(i, (memAddress >> 2) & offset_mask) && (isRead || !(meta[i] & LINE_SHARED));
+  }
+
+  // Makes this cache keep peer informed of its reads and writes
+  void addPeer(Cache *peer) {
+    peers.push_back(peer);
+    lostToPeer.assign(MEMORY_SIZE / blockBytes(), 0);
+  }
+
+  // A peer is about to read the block: a Modified copy here goes to memory
+  // first, and the copy becomes Shared. Returns whether there was one.
+  bool snoopRead(uint32_t block) {
+    int i = find(block & index_mask, (block >> index_bits) & LINE_TAG);
+    if (i < 0) {
+      return false;
+    }
+    if (isDirty(i)) {
+      write_to_mem(i);
+      interventions++;
+    }
+    meta[i] |= LINE_SHARED;
+    return true;
+  }
+
+  // A peer is about to write the block: a copy here goes to memory if
+  // Modified, then is dropped. Returns whether there was one.
+  bool snoopInvalidate(uint32_t block) {
+    int i = find(block & index_mask, (block >> index_bits) & LINE_TAG);
+    if (i < 0) {
+      return false;
+    }
+    if (isDirty(i)) {
+      write_to_mem(i);
+      interventions++;
+    }
+    meta[i] = 0;
+    if (i == refillLine) {
+      refillLine = -1;
+    }
+    if (profiling && block < evictedBy.size()) {
+      evictedBy[block] = SHADOW_NONE;
+    }
+    lostToPeer[block] = 1;
+    invalidationsReceived++;
+    return true;
+  }
+
+  // Takes the locks of this cache and every peer in core order, for an
+  // access that goes over the bus and so may snoop them
+  void lockCoherent() {
+    for (uint32_t c = 0; c <= peers.size(); c++) {
+      (c == coreIndex ? this : peers[c < coreIndex ? c : c - 1])->lock.lock();
+    }
+  }
+
+  void unlockCoherent() {
+    lock.unlock();
+    for (uint32_t p = 0; p < peers.size(); p++) {
+      peers[p]->lock.unlock();
+    }
+  }
+
+  // Has every peer drop its copy of the block before this cache writes it.
+  // The caller holds the peers' locks (see lockCoherent).
+  void invalidatePeers(uint32_t block) {
+    for (uint32_t p = 0; p < peers.size(); p++) {
+      invalidationsSent += peers[p]->snoopInvalidate(block);
+    }
+  }
+
+  // Puts lower below this cache, so misses and write-backs go to it
+  void attach(Cache *lower) {
+    next = lower;
+    lower->uppers.push_back(this);
+  }
+
+  // Logs the old contents of an entry before it is changed
+  void record(uint32_t index, uint32_t oldMeta, uint32_t oldValid, uint32_t oldDirty,
+              const uint32_t *block) {
+    journal.push_back(index);
+    journal.push_back(oldMeta);
+    journal.push_back(oldValid);
+    journal.push_back(oldDirty);
+    journal.insert(journal.end(), block, block + (1 << block_bits));
+  }
+
+  void saveLine(uint32_t i) {
+    if (journaling) {
+      record(i, meta[i], sectors ? sectorValid[i] : 0, sectors ? sectorDirty[i] : 0, line(i));
+    }
+  }
+
+  void saveVictim(uint32_t e) {
+    if (journaling) {
+      record(numLines() + e, victimMeta[e], 0, 0, victimLine(e));
+    }
+  }
+
+  // Writes the dirty sectors of line i to the next level, or straight to
+  // memory
+  void writeSectors(uint32_t i, bool toMemory) {
+    uint32_t words = 1 << sector_bits;
+    for (uint32_t k = 0; k < sectors; k++) {
+      if (!((sectorDirty[i] >> k) & 1)) {
+        continue;
+      }
+      uint32_t address = blockAddress(i) + k * words * WORD_SIZE;
+      if (next && !toMemory) {
+        next->writeBlock(address, line(i) + k * words, words);
+      } else {
+        memWrite(mem, address, line(i) + k * words, words);
+      }
+      bytesWritten += words * WORD_SIZE;
+    }
+    sectorDirty[i] = 0;
+  }
+
+  // Writes the dirty block in line i straight to memory
+  void write_to_mem(uint32_t i) {
+    if (sectors) {
+      writeSectors(i, true);
+    } else {
+      memWrite(mem, blockAddress(i), line(i), 1 << block_bits);
+      bytesWritten += blockBytes();
+    }
+    meta[i] &= ~LINE_DIRTY;
+    writeBacks++;
+  }
+
+  // Writes a modified block back to the next level
+  void write_back(uint32_t address, const uint32_t *src) {
+    if (next) {
+      next->writeBlock(address, src, 1 << block_bits);
+    } else {
+      memWrite(mem, address, src, 1 << block_bits);
+    }
+    writeBacks++;
+    bytesWritten += blockBytes();
+  }
+
+  // Writes the block in line i back to the next level if it was modified
+  void evict_block(uint32_t i) {
+    if (!isDirty(i)) {
+      return;
+    }
+    if (sectors) {
+      writeSectors(i, false);
+      writeBacks++;
+    } else {
+      write_back(blockAddress(i), line(i));
+    }
+    meta[i] &= ~LINE_DIRTY;
+  }
+
+  // Drops the block at address from the levels above if this level is
+  // inclusive and has just let go of it
+  void backInvalidate(uint32_t address) {
+    if (!inclusive) {
+      return;
+    }
+    for (uint32_t u = 0; u < uppers.size(); u++) {
+      backInvalidations += uppers[u]->invalidateRange(address, blockBytes());
+    }
+  }
+
+  uint32_t *victimLine(uint32_t e) {
+    return &victimData[e << block_bits];
+  }
+
+  uint32_t victimAddress(uint32_t e) const {
+    return (victimMeta[e] & LINE_TAG) << (block_bits + 2);
+  }
+
+  // Returns the victim buffer entry holding the block number, or -1
+  int findVictim(uint32_t block) const {
+    for (uint32_t e = 0; e < victimMeta.size(); e++) {
+      if ((victimMeta[e] & LINE_KEY) == (LINE_VALID | block)) {
+        return e;
+      }
+    }
+    return -1;
+  }
+
+  // Returns the stream buffer entry holding the block number, or -1
+  int findStream(uint32_t block) const {
+    for (uint32_t e = 0; e < streamMeta.size(); e++) {
+      if ((streamMeta[e] & LINE_KEY) == (LINE_VALID | block)) {
+        return e;
+      }
+    }
+    return -1;
+  }
+
+  // Whether the block sits in the victim buffer or a stream buffer rather
+  // than in the cache proper
+  bool inSideBuffers(uint32_t set, uint32_t tag) const {
+    uint32_t block = (tag << index_bits) | set;
+    return (!victimMeta.empty() && findVictim(block) >= 0) ||
+           (!streamMeta.empty() && findStream(block) >= 0);
+  }
+
+  // Moves line i into the victim buffer, writing back the least recently
+  // used entry if the buffer is full
+  void stashVictim(uint32_t i) {
+    uint32_t e = 0;
+    for (uint32_t k = 0; k < victimMeta.size(); k++) {
+      if (!(victimMeta[k] & LINE_VALID)) {
+        e = k;
+        break;
+      }
+      if (victimAge[k] < victimAge[e]) {
+        e = k;
+      }
+    }
+    if (victimMeta[e] & LINE_VALID) {
+      if (victimMeta[e] & LINE_DIRTY) {
+        write_back(victimAddress(e), victimLine(e));
+      }
+      backInvalidate(victimAddress(e));
+    }
+    saveVictim(e);
+    victimMeta[e] = (meta[i] & (LINE_VALID | LINE_DIRTY)) | (blockAddress(i) >> (block_bits + 2));
+    std::copy(line(i), line(i) + (1 << block_bits), victimLine(e));
+    victimAge[e] = ++clock;
+  }
+
+  uint32_t beats() const {
+    return (busWidth && busWidth < blockBytes()) ? blockBytes() / busWidth : 1;
+  }
+
+  // Reads a block from the next level into dst, returning the cycles until
+  // all of it is in
+  uint32_t fetchBlock(uint32_t address, uint32_t *dst) {
+    return fetchWords(address, dst, 1 << block_bits);
+  }
+
+  // Brings the sectors in mask of the block at address into line i,
+  // returning the cycles until the last of them is in. Each run of adjacent
+  // sectors is one transfer.
+  uint32_t fetchSectors(uint32_t i, uint32_t address, uint32_t mask) {
+    uint32_t latency = 0;
+    uint32_t k = 0;
+    while (k < sectors) {
+      if (!((mask >> k) & 1)) {
+        k++;
+        continue;
+      }
+      uint32_t end = k;
+      while (end < sectors && ((mask >> end) & 1)) {
+        end++;
+      }
+      uint32_t word = k << sector_bits;
+      latency = std::max(latency, fetchWords(address + word * WORD_SIZE, line(i) + word,
+                                             (end - k) << sector_bits));
+      k = end;
+    }
+    return latency;
+  }
+
+  // Reads nWords from the next level into dst, returning the cycles until
+  // all of them are in
+  uint32_t fetchWords(uint32_t address, uint32_t *dst, uint32_t nWords) {
+    uint32_t bytes = nWords * WORD_SIZE;
+    bytesRead += bytes;
+    uint32_t latency;
+    if (next) {
+      next->now = now;
+      next->pc = pc;
+      next->readBlock(address, dst, nWords);
+      latency = next->hitLatency + next->penalty;
+    } else {
+      memRead(mem, address, dst, nWords);
+      latency = missLatency;
+    }
+    if (!busWidth) {
+      return latency;
+    }
+    // The refill queues behind the one still on the bus, then streams in
+    // one beat at a time
+    uint32_t wait = (busFreeAt > now) ? busFreeAt - now : 0;
+    busWaitCycles += wait;
+    uint32_t n = (busWidth < bytes) ? bytes / busWidth : 1;
+    busFreeAt = now + wait + latency + (n - 1) * beatLatency;
+    return busFreeAt - now;
+  }
+
+  // Cycle the given word of refillLine arrives
+  uint32_t wordReady(uint32_t word) const {
+    uint32_t n = beats();
+    uint32_t beat = (word * WORD_SIZE) / (blockBytes() / n);
+    uint32_t order;
+    switch (refill) {
+      case REFILL_CRITICAL_WORD_FIRST:
+        order = (beat + n - refillFirstBeat) % n;
+        break;
+      case REFILL_EARLY_RESTART:
+        order = beat;
+        break;
+      case REFILL_WHOLE_BLOCK:
+      default:
+        order = n - 1;
+        break;
+    }
+    return refillStart + order * beatLatency;
+  }
+
+  // Accounts for the first demand use of a prefetched line, stalling for
+  // whatever is left of its fetch. Returns whether line i was one.
+  bool usePrefetched(uint32_t i) {
+    if (!(meta[i] & LINE_PREFETCHED)) {
+      return false;
+    }
+    meta[i] &= ~LINE_PREFETCHED;
+    usefulPrefetches++;
+    if (readyAt[i] > now) {
+      latePrefetches++;
+      penalty = readyAt[i] - now;
+    }
+    return true;
+  }
+
+  // Whether the block is worth prefetching: inside memory and not already
+  // held anywhere in this cache
+  bool prefetchable(uint32_t block) const {
+    if (block >= MEMORY_SIZE / blockBytes()) {
+      return false;
+    }
+    uint32_t set = block & index_mask;
+    uint32_t tag = (block >> index_bits) & LINE_TAG;
+    return find(set, tag) < 0 && !inSideBuffers(set, tag);
+  }
+
+  // Fetches the block into the cache ahead of use
+  void prefetchBlock(uint32_t block) {
+    if (!prefetchable(block)) {
+      return;
+    }
+    uint32_t demand = penalty;
+    int i = fill(block & index_mask, (block >> index_bits) & LINE_TAG);
+    meta[i] |= LINE_PREFETCHED;
+    readyAt[i] = now + penalty;
+    penalty = demand;
+    prefetches++;
+  }
+
+  uint32_t *streamLine(uint32_t e) {
+    return &streamData[e << block_bits];
+  }
+
+  // Tops up the empty tail of stream buffer b with the blocks that follow it
+  void refillStream(uint32_t b) {
+    for (uint32_t e = b * prefetchDegree; e < (b + 1) * prefetchDegree; e++) {
+      if (streamMeta[e] & LINE_VALID) {
+        continue;
+      }
+      while (!prefetchable(streamNext[b])) {
+        if (streamNext[b] >= MEMORY_SIZE / blockBytes()) {
+          return;
+        }
+        streamNext[b]++;
+      }
+      streamMeta[e] = LINE_VALID | streamNext[b];
+      streamReady[e] = now + fetchBlock(streamNext[b] << index_shift, streamLine(e));
+      streamNext[b]++;
+      prefetches++;
+    }
+  }
+
+  // Points the least recently used stream buffer at the blocks after a miss.
+  // It is filled once the access is done.
+  void startStream(uint32_t block) {
+    uint32_t b = 0;
+    for (uint32_t k = 1; k < streamAge.size(); k++) {
+      if (streamAge[k] < streamAge[b]) {
+        b = k;
+      }
+    }
+    std::fill(streamMeta.begin() + b * prefetchDegree, streamMeta.begin() + (b + 1) * prefetchDegree, 0);
+    streamNext[b] = block + 1;
+    streamAge[b] = ++clock;
+    pendingStream = b;
+  }
+
+  // Moves stream buffer entry e into line i. The entries ahead of it in its
+  // buffer are dropped, and once the access is done the buffer fetches
+  // further along the stream.
+  void takeStream(uint32_t e, uint32_t i) {
+    std::copy(streamLine(e), streamLine(e) + (1 << block_bits), line(i));
+    usefulPrefetches++;
+    penalty = 0;
+    if (streamReady[e] > now) {
+      latePrefetches++;
+      penalty = streamReady[e] - now;
+    }
+    uint32_t b = e / prefetchDegree;
+    uint32_t first = b * prefetchDegree;
+    uint32_t used = e - first + 1;
+    for (uint32_t k = first; k < first + prefetchDegree; k++) {
+      if (k + used < first + prefetchDegree) {
+        streamMeta[k] = streamMeta[k + used];
+        streamReady[k] = streamReady[k + used];
+        std::copy(streamLine(k + used), streamLine(k + used) + (1 << block_bits), streamLine(k));
+      } else {
+        streamMeta[k] = 0;
+      }
+    }
+    streamAge[b] = ++clock;
+    pendingStream = b;
+  }
+
+  // Trains the prefetcher on a demand access. trigger is set for misses and
+  // for the first use of a prefetched line.
+  void prefetch(uint32_t memAddress, bool trigger, bool isRead);
+
+  // Drops every line overlapping [address, address + bytes), writing dirty
+  // ones to memory. Called by an inclusive level below when it evicts.
+  // Returns how many lines were dropped.
+  uint32_t invalidateRange(uint32_t address, uint32_t bytes) {
+    uint32_t dropped = 0;
+    uint32_t step = blockBytes();
+    for (uint32_t a = address & ~(step - 1); a < address + bytes; a += step) {
+      int i = find((a >> index_shift) & index_mask, (a >> tag_shift) & LINE_TAG);
+      if (i < 0) {
+        continue;
+      }
+      saveLine(i);
+      if (profiling && (a >> index_shift) < evictedBy.size()) {
+        evictedBy[a >> index_shift] = SHADOW_NONE;
+      }
+      if (isDirty(i)) {
+        write_to_mem(i);
+      }
+      meta[i] = 0;
+      dropped++;
+    }
+    for (uint32_t e = 0; e < victimMeta.size(); e++) {
+      if ((victimMeta[e] & LINE_VALID) && victimAddress(e) >= (address & ~(step - 1)) &&
+          victimAddress(e) < address + bytes) {
+        saveVictim(e);
+        if (victimMeta[e] & LINE_DIRTY) {
+          memWrite(mem, victimAddress(e), victimLine(e), 1 << block_bits);
+          writeBacks++;
+          bytesWritten += blockBytes();
+        }
+        victimMeta[e] = 0;
+        dropped++;
+      }
+    }
+    for (uint32_t e = 0; e < streamMeta.size(); e++) {
+      uint32_t a = (streamMeta[e] & LINE_TAG) << index_shift;
+      if ((streamMeta[e] & LINE_VALID) && a >= (address & ~(step - 1)) && a < address + bytes) {
+        streamMeta[e] = 0;
+      }
+    }
+    return dropped;
+  }
+
+  void shadowUnlink(uint32_t block) {
+    uint32_t prev = shadowPrev[block];
+    uint32_t next = shadowNext[block];
+    if (prev != SHADOW_NONE) {
+      shadowNext[prev] = next;
+    } else {
+      shadowHead = next;
+    }
+    if (next != SHADOW_NONE) {
+      shadowPrev[next] = prev;
+    } else {
+      shadowTail = prev;
+    }
+  }
+
+  void shadowPushFront(uint32_t block) {
+    shadowPrev[block] = SHADOW_NONE;
+    shadowNext[block] = shadowHead;
+    if (shadowHead != SHADOW_NONE) {
+      shadowPrev[shadowHead] = block;
+    } else {
+      shadowTail = block;
+    }
+    shadowHead = block;
+  }
+
+  // Classifies a demand access against the shadow caches and counts it
+  // against its set. A miss on a tag the cache holds (present) only lacked a
+  // sector, and is left to sectorMisses.
+  void profileAccess(uint32_t set, uint32_t tag, bool present, bool hit) {
+    uint32_t block = (tag << index_bits) | set;
+    if (block >= seenBlocks.size()) {
+      return;
+    }
+    bool shadowHit = shadowHeld[block];
+    if (hit) {
+      setHits[set]++;
+    } else {
+      setMisses[set]++;
+    }
+    if (!hit && !present) {
+      if (!seenBlocks[block]) {
+        compulsoryMisses++;
+      } else if (evictedBy[block] == SHADOW_NONE) {
+        invalidationMisses++;
+      } else if (shadowHit) {
+        conflictMisses++;
+        if (evictedBy[block]) {
+          conflictPairs[std::make_pair(block, evictedBy[block] - 1)]++;
+        }
+      } else {
+        capacityMisses++;
+      }
+    }
+    seenBlocks[block] = 1;
+    evictedBy[block] = 0;
+
+    if (shadowHit) {
+      shadowUnlink(block);
+    } else if (shadowCount == numLines()) {
+      uint32_t oldest = shadowTail;
+      shadowUnlink(oldest);
+      shadowHeld[oldest] = 0;
+    } else {
+      shadowCount++;
+    }
+    shadowHeld[block] = 1;
+    shadowPushFront(block);
+  }
+
+  // Notes that the block in line i is being replaced by block
+  void profileEviction(uint32_t i, uint32_t block) {
+    setEvictions[i >> way_bits]++;
+    uint32_t old = blockAddress(i) >> index_shift;
+    if (old < evictedBy.size()) {
+      evictedBy[old] = block + 1;
+    }
+  }
+
+  // Slot of predictedWay used for an access to the set
+  uint32_t wayPredictorSlot(uint32_t set) const {
+    if (wayPrediction == WAY_PREDICT_MRU) {
+      return set;
+    }
+    return (pc >> 2) % predictedWay.size();
+  }
+
+  // Returns the write buffer entry for the block number, or -1
+  int findBuffered(uint32_t block) const {
+    for (uint32_t b = 0; b < writeBuffer.size(); b++) {
+      if (writeBuffer[b].block == block) {
+        return b;
+      }
+    }
+    return -1;
+  }
+
+  // Writes the bytes of value under mask at address to the next level, or
+  // straight to memory
+  void writeMasked(uint32_t address, uint32_t value, uint32_t mask, bool toMemory) {
+    uint32_t size = (mask == 0xffffffff) ? WORD_SIZE : BYTE_SIZE;
+    for (uint32_t k = 0; k < WORD_SIZE; k += size) {
+      uint32_t shift = (size == WORD_SIZE) ? 0 : 8 * (3 - k);
+      uint32_t lane = (size == WORD_SIZE) ? mask : (0xff << shift);
+      if (!(mask & lane)) {
+        continue;
+      }
+      uint32_t v = (value & lane) >> shift;
+      if (toMemory) {
+        mem->setMemValue(address + k, v, (MemEntrySize)size);
+        bytesWritten += size;
+      } else {
+        writeThrough(address + k, &v, size);
+      }
+    }
+  }
+
+  // Applies a drained entry: into the line or victim entry holding the
+  // block if there is one, as a store hit would, otherwise to the next level
+  // (or memory for the final flush)
+  void applyWrite(const WriteBufferEntry & w, bool toMemory) {
+    uint32_t set = w.block & index_mask;
+    uint32_t tag = (w.block >> index_bits) & LINE_TAG;
+    uint32_t address = w.block << index_shift;
+    int i = find(set, tag);
+    int e = victimMeta.empty() ? -1 : findVictim(w.block);
+    uint32_t *dst = NULL;
+    if (i >= 0) {
+      saveLine(i);
+      dst = line(i);
+      if (writePolicy == WRITE_BACK) {
+        meta[i] |= LINE_DIRTY;
+      }
+      if (sectors) {
+        // Missing sectors come in first so the bytes around the stores are
+        // right
+        uint32_t touched = 0;
+        for (uint32_t k = 0; k < w.mask.size(); k++) {
+          touched |= w.mask[k] ? sectorsOf(k, 1) : 0;
+        }
+        uint32_t missing = touched & ~sectorValid[i];
+        if (missing) {
+          fetchSectors(i, address, missing);
+          sectorValid[i] |= missing;
+        }
+        if (writePolicy == WRITE_BACK) {
+          sectorDirty[i] |= touched;
+        }
+      }
+    } else if (e >= 0) {
+      saveVictim(e);
+      dst = victimLine(e);
+      if (writePolicy == WRITE_BACK) {
+        victimMeta[e] |= LINE_DIRTY;
+      }
+    }
+    int s = streamMeta.empty() ? -1 : findStream(w.block);
+    if (s >= 0) {
+      streamMeta[s] = 0;
+    }
+    for (uint32_t k = 0; k < w.data.size(); k++) {
+      if (!w.mask[k]) {
+        continue;
+      }
+      if (dst) {
+        dst[k] = (dst[k] & ~w.mask[k]) | (w.data[k] & w.mask[k]);
+      }
+      if (!dst || writePolicy == WRITE_THROUGH) {
+        writeMasked(address + k * WORD_SIZE, w.data[k], w.mask[k], toMemory);
+      }
+    }
+    drains++;
+  }
+
+  // Applies the entries whose drain has finished by now
+  void retireWrites() {
+    while (!writeBuffer.empty() && writeBuffer[0].readyAt <= now) {
+      applyWrite(writeBuffer[0], false);
+      writeBuffer.erase(writeBuffer.begin());
+      writeBufferChanged = true;
+    }
+  }
+
+  // Waits for entries 0..b to drain and applies them. Returns the cycles
+  // that takes.
+  uint32_t drainThrough(uint32_t b) {
+    uint32_t wait = (writeBuffer[b].readyAt > now) ? writeBuffer[b].readyAt - now : 0;
+    for (uint32_t k = 0; k <= b; k++) {
+      applyWrite(writeBuffer[k], false);
+    }
+    writeBuffer.erase(writeBuffer.begin(), writeBuffer.begin() + b + 1);
+    writeBufferChanged = true;
+    return wait;
+  }
+
+  // Retires a store of the bits under mask into the write buffer, merging it
+  // into the block's entry if it has one. Returns the cycles spent waiting
+  // for a free entry.
+  uint32_t bufferStore(uint32_t block, uint32_t word, uint32_t value, uint32_t mask) {
+    uint32_t wait = 0;
+    int b = findBuffered(block);
+    if (b >= 0) {
+      coalescedStores++;
+    } else {
+      if (writeBuffer.size() == writeBufferEntries) {
+        wait = drainThrough(0);
+        bufferFullStalls += wait;
+      }
+      WriteBufferEntry w;
+      w.block = block;
+      // Drains go one at a time, after the entry ahead of this one
+      uint32_t start = now + wait;
+      if (!writeBuffer.empty() && writeBuffer.back().readyAt > start) {
+        start = writeBuffer.back().readyAt;
+      }
+      w.readyAt = start + (next ? next->hitLatency : missLatency);
+      w.data.assign(1 << block_bits, 0);
+      w.mask.assign(1 << block_bits, 0);
+      writeBuffer.push_back(w);
+      b = writeBuffer.size() - 1;
+    }
+    WriteBufferEntry & w = writeBuffer[b];
+    w.data[word] = (w.data[word] & ~mask) | (value & mask);
+    w.mask[word] |= mask;
+    bufferedStores++;
+    writeBufferChanged = true;
+    return wait;
+  }
+
+  // Writes every dirty line straight to memory. Flush lower levels first so
+  // the newer copies held above land on top of theirs.
+  void writeBackAll() {
+    // Buffered stores are the newest copies, so they go into the lines first
+    for (uint32_t b = 0; b < writeBuffer.size(); b++) {
+      applyWrite(writeBuffer[b], true);
+    }
+    writeBuffer.clear();
+    for (uint32_t i = 0; i < numLines(); i++) {
+      if (isValid(i) && isDirty(i)) {
+        write_to_mem(i);
+      }
+    }
+    for (uint32_t e = 0; e < victimMeta.size(); e++) {
+      if ((victimMeta[e] & LINE_VALID) && (victimMeta[e] & LINE_DIRTY)) {
+        memWrite(mem, victimAddress(e), victimLine(e), 1 << block_bits);
+        victimMeta[e] &= ~LINE_DIRTY;
+        writeBacks++;
+        bytesWritten += blockBytes();
+      }
+    }
+  }
+
+  // Starts logging changes so rollback() can undo them
+  void startJournal() {
+    journaling = true;
+    journal.clear();
+  }
+
+  // Makes the current contents the ones rollback() returns to
+  void commit() {
+    journal.clear();
+    if (writeBufferChanged) {
+      committedWriteBuffer = writeBuffer;
+      writeBufferChanged = false;
+    }
+  }
+
+  // Restores the lines and victim entries to how they were at the last
+  // commit(), newest change first
+  void rollback() {
+    uint32_t size = 4 + (1 << block_bits);
+    while (!journal.empty()) {
+      const uint32_t *r = &journal[journal.size() - size];
+      uint32_t *dst;
+      if (r[0] < numLines()) {
+        meta[r[0]] = r[1];
+        if (sectors) {
+          sectorValid[r[0]] = r[2];
+          sectorDirty[r[0]] = r[3];
+        }
+        dst = line(r[0]);
+      } else {
+        victimMeta[r[0] - numLines()] = r[1];
+        dst = victimLine(r[0] - numLines());
+      }
+      std::copy(r + 4, r + size, dst);
+      journal.resize(journal.size() - size);
+    }
+    if (journaling) {
+      writeBuffer = committedWriteBuffer;
+    }
+  }
+
+  // Passes a store of size bytes on to the next level
+  void writeThrough(uint32_t memAddress, uint32_t *data_ptr, uint32_t size) {
+    if (next) {
+      next->access(memAddress, data_ptr, false, size);
+    } else {
+      mem->setMemValue(memAddress, *data_ptr, (MemEntrySize)size);
+    }
+    bytesWritten += size;
+  }
+
+  // Serves a block fill from the level above, counting one access per block
+  // of this cache it touches
+  void readBlock(uint32_t address, uint32_t *dst, uint32_t nWords);
+
+  // Takes a write-back from the level above
+  void writeBlock(uint32_t address, const uint32_t *src, uint32_t nWords);
+
+  // Looks up the block holding memAddress, filling it on a miss. Returns the
+  // line and sets hit.
+  template <class Policy, bool Direct>
+  int locate(uint32_t memAddress, bool & hit);
+  int locate(uint32_t memAddress, bool & hit);
+
+  // Brings the block with this set and tag into the set, evicting if needed
+  template <class Policy, bool Direct>
+  int fill(uint32_t set, uint32_t tag);
+  int fill(uint32_t set, uint32_t tag);
+
+  // Access specialized on the policy, associativity, direction and size, so
+  // the byte masks and the way search fold away at compile time
+  template <class Policy, bool Direct, bool IsRead, uint32_t Size>
+  bool access(uint32_t memAddress, uint32_t *data_ptr);
+
+  // Picks the policy and associativity specialization for this cache
+  template <bool IsRead, uint32_t Size>
+  bool access(uint32_t memAddress, uint32_t *data_ptr);
+
+  // Reads or writes size bytes at memAddress, filling the block on a miss.
+  // Returns whether the access hit.
+  bool access(uint32_t memAddress, uint32_t *data_ptr, bool isRead, uint32_t size);
+
+  void printStats(std::ostream & out, const char *name) const {
+    out << std::dec << name << " (" << replacementName(policy) << ") hits: " << hits
+        << ", misses: " << misses << ", evictions: " << evictions
+        << ", write-backs: " << writeBacks << ", bytes read: " << bytesRead
+        << ", bytes written: " << bytesWritten;
+    if (inclusive) {
+      out << ", back-invalidations: " << backInvalidations;
+    }
+    if (!victimMeta.empty()) {
+      out << ", victim hits: " << victimHits;
+    }
+    if (sectors) {
+      out << ", sectors: " << sectors << " of " << (WORD_SIZE << sector_bits) << " bytes"
+          << ", sector misses: " << sectorMisses;
+    }
+    if (!peers.empty()) {
+      out << ", coherence misses: " << coherenceMisses << ", upgrades: " << upgrades
+          << ", invalidations sent: " << invalidationsSent
+          << ", invalidations received: " << invalidationsReceived
+          << ", interventions: " << interventions << ", bus accesses: " << busAccesses;
+    }
+    if (wayPrediction != WAY_PREDICT_NONE) {
+      uint32_t scored = wayPredictedHits + wayMispredictedHits;
+      out << ", way prediction: " << wayPredictionName(wayPrediction)
+          << ", mispredicted hits: " << wayMispredictedHits
+          << ", accuracy: " << (scored ? 100.0 * wayPredictedHits / scored : 0) << "%";
+    }
+    if (writeBufferEntries) {
+      out << ", write buffer: " << writeBufferEntries << " entries, buffered stores: " << bufferedStores
+          << ", coalesced: " << coalescedStores << ", drains: " << drains
+          << ", forwarded loads: " << forwardedLoads << ", full stall cycles: " << bufferFullStalls;
+    }
+    if (busWidth) {
+      out << ", refill: " << refillName(refill) << " over " << beats() << " beats"
+          << ", bus wait cycles: " << busWaitCycles
+          << ", cycles saved by early restart: " << earlyRestartSaved;
+    }
+    if (prefetcher != PREFETCH_NONE) {
+      // Stream buffer hits already count as misses, in-cache prefetch hits
+      // would have been misses without the prefetcher
+      uint32_t wouldMiss = misses + (streamMeta.empty() ? usefulPrefetches : 0);
+      out << ", prefetcher: " << prefetcherName(prefetcher)
+          << ", prefetches: " << prefetches << ", useful: " << usefulPrefetches
+          << ", late: " << latePrefetches
+          << ", accuracy: " << (prefetches ? 100.0 * usefulPrefetches / prefetches : 0) << "%"
+          << ", coverage: " << (wouldMiss ? 100.0 * usefulPrefetches / wouldMiss : 0) << "%"
+          << ", timeliness: "
+          << (usefulPrefetches ? 100.0 * (usefulPrefetches - latePrefetches) / usefulPrefetches : 0)
+          << "%";
+    }
+    out << std::endl;
+    if (profiling) {
+      out << name << " misses by cause: compulsory: " << compulsoryMisses
+          << ", capacity: " << capacityMisses << ", conflict: " << conflictMisses
+          << ", invalidation: " << invalidationMisses;
+      if (sectors) {
+        out << ", sector: " << sectorMisses;
+      }
+      out << std::endl;
+    }
+  }
+
+  // Writes the miss classification and per-set counts as a JSON member
+  // "name": {...}, listing the pairs of blocks that most often evicted each
+  // other in each set
+  void writeProfile(std::ostream & out, const char *name) const {
+    const uint32_t topPairs = 3;
+    // (count, (missed block, evicting block)), bucketed by set
+    typedef std::pair<uint32_t, std::pair<uint32_t, uint32_t> > CountedPair;
+    std::vector<std::vector<CountedPair> > pairs(setHits.size());
+    for (std::map<std::pair<uint32_t, uint32_t>, uint32_t>::const_iterator it = conflictPairs.begin();
+         it != conflictPairs.end(); ++it) {
+      pairs[it->first.first & index_mask].push_back(std::make_pair(it->second, it->first));
+    }
+    out << std::dec << "  \"" << name << "\": {\n"
+        << "    \"hits\": " << hits << ",\n"
+        << "    \"misses\": " << misses << ",\n"
+        << "    \"compulsory\": " << compulsoryMisses << ",\n"
+        << "    \"capacity\": " << capacityMisses << ",\n"
+        << "    \"conflict\": " << conflictMisses << ",\n"
+        << "    \"invalidation\": " << invalidationMisses << ",\n"
+        << "    \"sector\": " << sectorMisses << ",\n"
+        << "    \"sets\": [";
+    for (uint32_t set = 0; set < setHits.size(); set++) {
+      std::vector<CountedPair> & p = pairs[set];
+      uint32_t n = std::min<uint32_t>(topPairs, p.size());
+      std::partial_sort(p.begin(), p.begin() + n, p.end(),
+                        std::greater<CountedPair>());
+      out << (set ? ",\n" : "\n") << "      {\"set\": " << set << ", \"hits\": " << setHits[set]
+          << ", \"misses\": " << setMisses[set] << ", \"evictions\": " << setEvictions[set]
+          << ", \"conflicts\": [";
+      for (uint32_t k = 0; k < n; k++) {
+        out << (k ? ", " : "") << "{\"address\": " << (p[k].second.first << index_shift)
+            << ", \"evictedBy\": " << (p[k].second.second << index_shift)
+            << ", \"count\": " << p[k].first << "}";
+      }
+      out << "]}";
+    }
+    out << "\n    ]\n  }";
+  }
+};
+
+// Replacement policies. Each one keeps its per-line state in Cache::repl and
+// is passed to Cache::access as a template parameter, so the hit path inlines
+// the policy's bookkeeping instead of going through a virtual call.
+
+// True LRU: repl holds the access time, the oldest line is replaced
+struct LRUPolicy {
+  static void onHit(Cache & c, uint32_t i) {
+    c.repl[i] = ++c.clock;
+  }
+  static void onFill(Cache & c, uint32_t i) {
+    c.repl[i] = ++c.clock;
+  }
+  static uint32_t victim(Cache & c, uint32_t set) {
+    uint32_t base = set << c.way_bits;
+    uint32_t oldest = base;
+    for (uint32_t i = base + 1; i < base + c.ways; i++) {
+      if (c.repl[i] < c.repl[oldest]) {
+        oldest = i;
+      }
+    }
+    return oldest;
+  }
+};
+
+// FIFO: repl holds the fill time, hits do not refresh it
+struct FIFOPolicy {
+  static void onHit(Cache &, uint32_t) {
+  }
+  static void onFill(Cache & c, uint32_t i) {
+    c.repl[i] = ++c.clock;
+  }
+  static uint32_t victim(Cache & c, uint32_t set) {
+    return LRUPolicy::victim(c, set);
+  }
+};
+
+// Tree pseudo-LRU: node k (1 .. ways - 1, heap order) of a set is stored in
+// repl[base + k] and points towards the less recently used half
+struct TreePLRUPolicy {
+  static void onHit(Cache & c, uint32_t i) {
+    uint32_t base = i & ~(c.ways - 1);
+    uint32_t node = (i - base) + c.ways;
+    while (node > 1) {
+      c.repl[base + (node >> 1)] = !(node & 1);
+      node >>= 1;
+    }
+  }
+  static void onFill(Cache & c, uint32_t i) {
+    onHit(c, i);
+  }
+  static uint32_t victim(Cache & c, uint32_t set) {
+    uint32_t base = set << c.way_bits;
+    uint32_t node = 1;
+    while (node < c.ways) {
+      node = 2 * node + c.repl[base + node];
+    }
+    return base + node - c.ways;
+  }
+};
+
+// Static RRIP with 2-bit re-reference prediction values
+#define RRPV_MAX 3
+struct SRRIPPolicy {
+  static void onHit(Cache & c, uint32_t i) {
+    c.repl[i] = 0;
+  }
+  static void onFill(Cache & c, uint32_t i) {
+    c.repl[i] = RRPV_MAX - 1;
+  }
+  static uint32_t victim(Cache & c, uint32_t set) {
+    uint32_t base = set << c.way_bits;
+    uint32_t oldest = base;
+    for (uint32_t i = base; i < base + c.ways; i++) {
+      if (c.repl[i] > c.repl[oldest]) {
+        oldest = i;
+      }
+    }
+    // Age the whole set until the chosen line reaches the distant value
+    uint32_t age = RRPV_MAX - c.repl[oldest];
+    if (age) {
+      for (uint32_t i = base; i < base + c.ways; i++) {
+        c.repl[i] += age;
+      }
+    }
+    return oldest;
+  }
+};
+
+// Bimodal RRIP: inserts at the distant value except for one fill in 32
+struct BRRIPPolicy {
+  static void onHit(Cache & c, uint32_t i) {
+    c.repl[i] = 0;
+  }
+  static void onFill(Cache & c, uint32_t i) {
+    c.repl[i] = (c.nextRandom() & 31) ? RRPV_MAX : RRPV_MAX - 1;
+  }
+  static uint32_t victim(Cache & c, uint32_t set) {
+    return SRRIPPolicy::victim(c, set);
+  }
+};
+
+// Random replacement from the seeded generator
+struct RandomPolicy {
+  static void onHit(Cache &, uint32_t) {
+  }
+  static void onFill(Cache &, uint32_t) {
+  }
+  static uint32_t victim(Cache & c, uint32_t set) {
+    return (set << c.way_bits) + (c.nextRandom() & (c.ways - 1));
+  }
+};
+
+template <class Policy, bool Direct>
+inline int Cache::fill(uint32_t set, uint32_t tag) {
+  // Fill an empty way if there is one, otherwise ask the policy
+  int i;
+  if (Direct) {
+    i = set;
+  } else {
+    i = findInvalid(set);
+    if (i < 0) {
+      i = Policy::victim(*this, set);
+    }
+  }
+  saveLine(i);
+  uint32_t wanted = fillSectors;
+  fillSectors = allSectors;
+  bool exclusive = fillExclusive;
+  fillExclusive = false;
+  // Only whole lines go into the victim buffer
+  bool partial = sectors && sectorValid[i] != allSectors;
+  if (i == refillLine) {
+    refillLine = -1;
+  }
+  if (profiling && isValid(i)) {
+    profileEviction(i, (tag << index_bits) | set);
+  }
+  if (!victimMeta.empty()) {
+    // A hit in the victim buffer swaps the block with the one being evicted
+    int e = findVictim((tag << index_bits) | set);
+    if (e >= 0) {
+      victimHits++;
+      saveVictim(e);
+      uint32_t dirty = victimMeta[e] & LINE_DIRTY;
+      if (isValid(i) && !partial) {
+        evictions++;
+        std::swap_ranges(line(i), line(i) + (1 << block_bits), victimLine(e));
+        victimMeta[e] = (meta[i] & (LINE_VALID | LINE_DIRTY)) | (blockAddress(i) >> (block_bits + 2));
+        victimAge[e] = ++clock;
+      } else {
+        if (isValid(i)) {
+          evictions++;
+          evict_block(i);
+          backInvalidate(blockAddress(i));
+        }
+        std::copy(victimLine(e), victimLine(e) + (1 << block_bits), line(i));
+        victimMeta[e] = 0;
+      }
+      meta[i] = LINE_VALID | dirty | tag;
+      if (sectors) {
+        sectorValid[i] = allSectors;
+        sectorDirty[i] = dirty ? allSectors : 0;
+      }
+      penalty = victimLatency;
+      if (!Direct) {
+        Policy::onFill(*this, i);
+      }
+      return i;
+    }
+    if (isValid(i) && partial) {
+      evictions++;
+      evict_block(i);
+      backInvalidate(blockAddress(i));
+    } else if (isValid(i)) {
+      evictions++;
+      stashVictim(i);
+    }
+  } else if (isValid(i)) {
+    evictions++;
+    evict_block(i);
+    backInvalidate(blockAddress(i));
+  }
+  // The line only takes the new tag once its data is in, so a level below
+  // that back-invalidates during the fetch cannot drop it half-filled
+  uint32_t block = (tag << index_bits) | set;
+  // Peers holding the block put their latest copy in memory first, and
+  // drop it if this cache is about to write
+  bool shared = false;
+  if (!peers.empty()) {
+    if (exclusive) {
+      invalidatePeers(block);
+    } else {
+      for (uint32_t p = 0; p < peers.size(); p++) {
+        shared |= peers[p]->snoopRead(block);
+      }
+    }
+    lostToPeer[block] = 0;
+  }
+  int e = streamMeta.empty() ? -1 : findStream(block);
+  if (e >= 0) {
+    takeStream(e, i);
+    wanted = allSectors;
+  } else {
+    if (sectors) {
+      penalty = fetchSectors(i, block << index_shift, wanted);
+    } else {
+      penalty = fetchBlock(block << index_shift, line(i));
+    }
+    if (!streamMeta.empty()) {
+      startStream(block);
+    }
+  }
+  meta[i] = LINE_VALID | tag | (shared ? LINE_SHARED : 0);
+  if (sectors) {
+    sectorValid[i] = wanted;
+    sectorDirty[i] = 0;
+  }
+  if (!Direct) {
+    Policy::onFill(*this, i);
+  }
+  return i;
+}
+
+inline int Cache::fill(uint32_t set, uint32_t tag) {
+  if (isDirect) {
+    return fill<LRUPolicy, true>(set, tag);
+  }
+  switch (policy) {
+    case REPL_TREE_PLRU:
+      return fill<TreePLRUPolicy, false>(set, tag);
+    case REPL_SRRIP:
+      return fill<SRRIPPolicy, false>(set, tag);
+    case REPL_BRRIP:
+      return fill<BRRIPPolicy, false>(set, tag);
+    case REPL_FIFO:
+      return fill<FIFOPolicy, false>(set, tag);
+    case REPL_RANDOM:
+      return fill<RandomPolicy, false>(set, tag);
+    case REPL_LRU:
+    default:
+      return fill<LRUPolicy, false>(set, tag);
+  }
+}
+
+// Next-N-line: a miss, or the first use of a prefetched line, fetches the N
+// blocks after it
+struct NextLinePrefetcher {
+  static void train(Cache & c, uint32_t memAddress, bool trigger, bool) {
+    if (!trigger) {
+      return;
+    }
+    uint32_t block = memAddress >> c.index_shift;
+    for (uint32_t k = 1; k <= c.prefetchDegree; k++) {
+      c.prefetchBlock(block + k);
+    }
+  }
+};
+
+// PC-indexed stride table trained on loads. Once the same stride has been
+// seen twice in a row from one instruction, the next prefetchDegree strides
+// ahead of it are fetched.
+#define STRIDE_CONFIDENT 2
+struct StridePrefetcher {
+  static void train(Cache & c, uint32_t memAddress, bool, bool isRead) {
+    if (!isRead) {
+      return;
+    }
+    StrideEntry & entry = c.strides[(c.pc >> 2) % c.strides.size()];
+    if (entry.pc != c.pc) {
+      entry.pc = c.pc;
+      entry.lastAddress = memAddress;
+      entry.stride = 0;
+      entry.confidence = 0;
+      return;
+    }
+    int32_t stride = memAddress - entry.lastAddress;
+    if (stride != 0 && stride == entry.stride) {
+      if (entry.confidence < STRIDE_CONFIDENT) {
+        entry.confidence++;
+      }
+    } else {
+      entry.stride = stride;
+      entry.confidence = 0;
+    }
+    entry.lastAddress = memAddress;
+    if (entry.confidence < STRIDE_CONFIDENT) {
+      return;
+    }
+    uint32_t block = memAddress >> c.index_shift;
+    for (uint32_t k = 1; k <= c.prefetchDegree; k++) {
+      uint32_t ahead = (memAddress + k * entry.stride) >> c.index_shift;
+      if (ahead != block) {
+        c.prefetchBlock(ahead);
+      }
+    }
+  }
+};
+
+inline void Cache::prefetch(uint32_t memAddress, bool trigger, bool isRead) {
+  switch (prefetcher) {
+    case PREFETCH_NEXT_LINE:
+      NextLinePrefetcher::train(*this, memAddress, trigger, isRead);
+      break;
+    case PREFETCH_STRIDE:
+      StridePrefetcher::train(*this, memAddress, trigger, isRead);
+      break;
+    case PREFETCH_STREAM:
+      // fill() has already matched or started a stream, so only the fetching
+      // is left
+      if (pendingStream >= 0) {
+        refillStream(pendingStream);
+        pendingStream = -1;
+      }
+      break;
+    case PREFETCH_NONE:
+      break;
+  }
+}
+
+template <class Policy, bool Direct>
+inline int Cache::locate(uint32_t memAddress, bool & hit) {
+  uint32_t set = (memAddress >> index_shift) & index_mask;
+  uint32_t tag = (memAddress >> tag_shift) & LINE_TAG;
+  int i = find(set, tag);
+  hit = (i >= 0) && (!sectors || !(fillSectors & ~sectorValid[i]));
+  if (profiling) {
+    profileAccess(set, tag, i >= 0, hit);
+  }
+  if (stackDistance.maxWays) {
+    stackDistance.access(memAddress);
+  }
+  if (hit) {
+    hits++;
+    penalty = 0;
+    if (!Direct) {
+      Policy::onHit(*this, i);
+    }
+    fillSectors = allSectors;
+    return i;
+  }
+  misses++;
+  if (i >= 0) {
+    // The tag is here, so only the missing sectors come in
+    sectorMisses++;
+    if (!Direct) {
+      Policy::onHit(*this, i);
+    }
+    saveLine(i);
+    uint32_t missing = fillSectors & ~sectorValid[i];
+    penalty = fetchSectors(i, blockAddress(i), missing);
+    sectorValid[i] |= missing;
+    fillSectors = allSectors;
+    return i;
+  }
+  return fill<Policy, Direct>(set, tag);
+}
+
+inline int Cache::locate(uint32_t memAddress, bool & hit) {
+  if (isDirect) {
+    return locate<LRUPolicy, true>(memAddress, hit);
+  }
+  switch (policy) {
+    case REPL_TREE_PLRU:
+      return locate<TreePLRUPolicy, false>(memAddress, hit);
+    case REPL_SRRIP:
+      return locate<SRRIPPolicy, false>(memAddress, hit);
+    case REPL_BRRIP:
+      return locate<BRRIPPolicy, false>(memAddress, hit);
+    case REPL_FIFO:
+      return locate<FIFOPolicy, false>(memAddress, hit);
+    case REPL_RANDOM:
+      return locate<RandomPolicy, false>(memAddress, hit);
+    case REPL_LRU:
+    default:
+      return locate<LRUPolicy, false>(memAddress, hit);
+  }
+}
+
+inline void Cache::readBlock(uint32_t address, uint32_t *dst, uint32_t nWords) {
+  uint32_t worst = 0;
+  while (nWords) {
+    int b = writeBuffer.empty() ? -1 : findBuffered(address >> index_shift);
+    if (b >= 0) {
+      drainThrough(b);
+    }
+    uint32_t offset = (address >> 2) & offset_mask;
+    uint32_t n = (1 << block_bits) - offset;
+    if (n > nWords) {
+      n = nWords;
+    }
+    if (sectors) {
+      fillSectors = sectorsOf(offset, n);
+    }
+    bool hit;
+    int i = locate(address, hit);
+    bool trigger = !hit;
+    if (hit) {
+      trigger = usePrefetched(i);
+    }
+    std::copy(line(i) + offset, line(i) + offset + n, dst);
+    if (penalty > worst) {
+      worst = penalty;
+    }
+    if (prefetcher != PREFETCH_NONE) {
+      prefetch(address, trigger, true);
+    }
+    address += n * WORD_SIZE;
+    dst += n;
+    nWords -= n;
+  }
+  penalty = worst;
+}
+
+inline void Cache::writeBlock(uint32_t address, const uint32_t *src, uint32_t nWords) {
+  while (nWords) {
+    uint32_t offset = (address >> 2) & offset_mask;
+    uint32_t n = (1 << block_bits) - offset;
+    if (n > nWords) {
+      n = nWords;
+    }
+    uint32_t set = (address >> index_shift) & index_mask;
+    uint32_t tag = (address >> tag_shift) & LINE_TAG;
+    int b = writeBuffer.empty() ? -1 : findBuffered(address >> index_shift);
+    if (b >= 0) {
+      drainThrough(b);
+    }
+    if (find(set, tag) >= 0 || writeMissPolicy == WRITE_ALLOCATE || inSideBuffers(set, tag)) {
+      if (sectors) {
+        // Sectors the write only partly covers have to be read in first
+        fillSectors = sectorsOf(offset, n) & ~sectorsWithin(offset, n);
+      }
+      bool hit;
+      int i = locate(address, hit);
+      saveLine(i);
+      std::copy(src, src + n, line(i) + offset);
+      if (sectors) {
+        sectorValid[i] |= sectorsOf(offset, n);
+      }
+      if (writePolicy == WRITE_THROUGH) {
+        memWrite(mem, address, src, n);
+        bytesWritten += n * WORD_SIZE;
+      } else {
+        meta[i] |= LINE_DIRTY;
+        if (sectors) {
+          sectorDirty[i] |= sectorsOf(offset, n);
+        }
+      }
+    } else {
+      misses++;
+      if (profiling) {
+        profileAccess(set, tag, false, false);
+      }
+      if (stackDistance.maxWays) {
+        stackDistance.access(address);
+      }
+      memWrite(mem, address, src, n);
+      bytesWritten += n * WORD_SIZE;
+    }
+    address += n * WORD_SIZE;
+    src += n;
+    nWords -= n;
+  }
+}
+
+template <class Policy, bool Direct, bool IsRead, uint32_t Size>
+inline bool Cache::access(uint32_t memAddress, uint32_t *data_ptr) {
+  uint32_t set = (memAddress >> index_shift) & index_mask;
+  uint32_t tag = (memAddress >> tag_shift) & LINE_TAG;
+  uint32_t block_offset = (memAddress >> 2) & offset_mask;
+
+  // Bit bashing to allow for half/byte reads/writes
+  const uint32_t byte_mask = (Size == WORD_SIZE) ? 0xffffffff : (0x1 << (8*Size)) - 1;
+  uint32_t byte_shift = (Size == WORD_SIZE) ? 0 : 32 - 8 * ((memAddress & 0x3) + Size);
+
+  int i;
+  // Line the way predictor points at, or -1 without one
+  int predicted = -1;
+  uint32_t slot = 0;
+  if (Direct) {
+    i = ((meta[set] & LINE_KEY) == (LINE_VALID | tag)) ? (int)set : -1;
+  } else if (wayPrediction != WAY_PREDICT_NONE) {
+    // Probe the predicted way first and only search the set if it is wrong
+    slot = wayPredictorSlot(set);
+    predicted = (set << way_bits) + predictedWay[slot];
+    i = ((meta[predicted] & LINE_KEY) == (LINE_VALID | tag)) ? predicted : find(set, tag);
+  } else {
+    i = find(set, tag);
+  }
+  bool hit = holdsWord(i, block_offset);
+  bool trigger = !hit;
+  if (stackDistance.maxWays) {
+    stackDistance.access(memAddress);
+  }
+  uint32_t bufferWait = 0;
+  if (writeBufferEntries) {
+    retireWrites();
+    // A drain may have filled in the sector asked for
+    hit = holdsWord(i, block_offset);
+    trigger = !hit;
+    uint32_t block = memAddress >> index_shift;
+    int b = writeBuffer.empty() ? -1 : findBuffered(block);
+    uint32_t bits = byte_mask << byte_shift;
+    if (!IsRead && (!hit || b >= 0)) {
+      // The store retires into the buffer and the pipeline goes on
+      if (hit) {
+        hits++;
+      } else {
+        misses++;
+        sectorMisses += (i >= 0);
+      }
+      if (profiling) {
+        profileAccess(set, tag, i >= 0, hit);
+      }
+      penalty = bufferStore(block, block_offset, *data_ptr << byte_shift, bits);
+      return hit;
+    }
+    if (IsRead && b >= 0) {
+      if ((writeBuffer[b].mask[block_offset] & bits) == bits) {
+        // Every byte asked for is buffered, so forward them
+        hits++;
+        forwardedLoads++;
+        if (profiling) {
+          profileAccess(set, tag, i >= 0, true);
+        }
+        penalty = 0;
+        *data_ptr = (writeBuffer[b].data[block_offset] >> byte_shift) & byte_mask;
+        return true;
+      }
+      if (writeBuffer[b].mask[block_offset] & bits) {
+        // Only some are, so wait for the entry to drain first
+        bufferWait = drainThrough(b);
+        hit = holdsWord(i, block_offset);
+      }
+    }
+  }
+  if (profiling) {
+    profileAccess(set, tag, i >= 0, hit);
+  }
+  if (hit) {
+    hits++;
+    penalty = 0;
+    if (!Direct) {
+      Policy::onHit(*this, i);
+    }
+    if (predicted >= 0) {
+      if (i == predicted) {
+        wayPredictedHits++;
+      } else {
+        // The second probe finds it a cycle or more later
+        wayMispredictedHits++;
+        penalty = wayMispredictPenalty;
+      }
+    }
+    trigger = usePrefetched(i);
+  } else if (i >= 0) {
+    // The tag is here but the sector is not, so only that sector comes in.
+    // A word store into word-sized sectors needs nothing read.
+    misses++;
+    sectorMisses++;
+    if (!Direct) {
+      Policy::onHit(*this, i);
+    }
+    saveLine(i);
+    uint32_t wanted = (!IsRead && Size == WORD_SIZE && sector_bits == 0) ? 0 : sectorsOf(block_offset, 1);
+    penalty = fetchSectors(i, blockAddress(i), wanted);
+    sectorValid[i] |= wanted;
+  } else if (!IsRead && writeMissPolicy == NO_WRITE_ALLOCATE && !inSideBuffers(set, tag)) {
+    // Store misses go straight to the next level without touching the cache
+    misses++;
+    if (!peers.empty()) {
+      invalidatePeers(memAddress >> index_shift);
+    }
+    writeThrough(memAddress, data_ptr, Size);
+    penalty = next ? next->hitLatency + next->penalty : missLatency;
+    return false;
+  } else {
+    misses++;
+    if (!peers.empty()) {
+      coherenceMisses += lostToPeer[memAddress >> index_shift];
+      fillExclusive = !IsRead;
+    }
+    uint32_t fetched = bytesRead;
+    if (sectors) {
+      fillSectors = (!IsRead && Size == WORD_SIZE && sector_bits == 0) ? 0 : sectorsOf(block_offset, 1);
+    }
+    i = fill<Policy, Direct>(set, tag);
+    if (busWidth && !sectors && bytesRead != fetched) {
+      // Only the word asked for has to be in before the pipeline goes on
+      uint32_t whole = penalty;
+      refillLine = i;
+      refillStart = now + whole - (beats() - 1) * beatLatency;
+      refillFirstBeat = (block_offset * WORD_SIZE) / (blockBytes() / beats());
+      penalty = wordReady(block_offset) - now;
+      earlyRestartSaved += whole - penalty;
+    }
+  }
+  if (hit && i == refillLine && wordReady(block_offset) > now + penalty) {
+    // The rest of the block is still on its way in
+    penalty = wordReady(block_offset) - now;
+  }
+  penalty += bufferWait;
+  if (predicted >= 0) {
+    predictedWay[slot] = i & (ways - 1);
+  }
+
+  uint32_t *word = &line(i)[block_offset];
+  if (IsRead) {
+    *data_ptr = ((*word >> byte_shift) & byte_mask);
+  } else {
+    saveLine(i);
+    if (meta[i] & LINE_SHARED) {
+      // Upgrade to Modified: the other copies go before this one changes
+      invalidatePeers(memAddress >> index_shift);
+      meta[i] &= ~LINE_SHARED;
+      upgrades++;
+      penalty += upgradeLatency;
+    }
+    // Clear the data, then write over it
+    *word &= ~(byte_mask << byte_shift);
+    *word |= (*data_ptr << byte_shift);
+    if (sectors) {
+      sectorValid[i] |= sectorsOf(block_offset, 1);
+    }
+    if (writePolicy == WRITE_THROUGH) {
+      writeThrough(memAddress, data_ptr, Size);
+    } else {
+      meta[i] |= LINE_DIRTY;
+      if (sectors) {
+        sectorDirty[i] |= sectorsOf(block_offset, 1);
+      }
+    }
+  }
+  if (prefetcher != PREFETCH_NONE) {
+    prefetch(memAddress, trigger, IsRead);
+  }
+  return hit;
+}
+
+template <bool IsRead, uint32_t Size>
+inline bool Cache::access(uint32_t memAddress, uint32_t *data_ptr) {
+  if (isDirect) {
+    return access<LRUPolicy, true, IsRead, Size>(memAddress, data_ptr);
+  }
+  switch (policy) {
+    case REPL_TREE_PLRU:
+      return access<TreePLRUPolicy, false, IsRead, Size>(memAddress, data_ptr);
+    case REPL_SRRIP:
+      return access<SRRIPPolicy, false, IsRead, Size>(memAddress, data_ptr);
+    case REPL_BRRIP:
+      return access<BRRIPPolicy, false, IsRead, Size>(memAddress, data_ptr);
+    case REPL_FIFO:
+      return access<FIFOPolicy, false, IsRead, Size>(memAddress, data_ptr);
+    case REPL_RANDOM:
+      return access<RandomPolicy, false, IsRead, Size>(memAddress, data_ptr);
+    case REPL_LRU:
+    default:
+      return access<LRUPolicy, false, IsRead, Size>(memAddress, data_ptr);
+  }
+}
+
+inline bool Cache::access(uint32_t memAddress, uint32_t *data_ptr, bool isRead, uint32_t size) {
+  if (isRead) {
+    switch (size) {
+      case BYTE_SIZE:
+        return access<true, BYTE_SIZE>(memAddress, data_ptr);
+      case HALF_SIZE:
+        return access<true, HALF_SIZE>(memAddress, data_ptr);
+      default:
+        return access<true, WORD_SIZE>(memAddress, data_ptr);
+    }
+  }
+  switch (size) {
+    case BYTE_SIZE:
+      return access<false, BYTE_SIZE>(memAddress, data_ptr);
+    case HALF_SIZE:
+      return access<false, HALF_SIZE>(memAddress, data_ptr);
+    default:
+      return access<false, WORD_SIZE>(memAddress, data_ptr);
+  }
+}
+
+// Writes the profiles of those caches that keep one to path as one JSON
+// object. Nothing is written if none do.
+static inline void writeProfiles(const char *path, Cache *const caches[], const char *const names[],
+                                 uint32_t count) {
+  bool any = false;
+  for (uint32_t c = 0; c < count; c++) {
+    any = any || caches[c]->profiling;
+  }
+  if (!any) {
+    return;
+  }
+  std::ofstream out(path);
+  out << "{";
+  bool first = true;
+  for (uint32_t c = 0; c < count; c++) {
+    if (caches[c]->profiling) {
+      out << (first ? "\n" : ",\n");
+      caches[c]->writeProfile(out, names[c]);
+      first = false;
+    }
+  }
+  out << "\n}\n";
+}
+
+// Writes the stack distance tables of those caches that keep one to path.
+// Nothing is written if none do.
+static inline void writeStackDistances(const char *path, Cache *const caches[],
+                                       const char *const names[], uint32_t count) {
+  bool any = false;
+  for (uint32_t c = 0; c < count; c++) {
+    any = any || caches[c]->stackDistance.maxWays;
+  }
+  if (!any) {
+    return;
+  }
+  std::ofstream out(path);
+  for (uint32_t c = 0; c < count; c++) {
+    if (caches[c]->stackDistance.maxWays) {
+      caches[c]->stackDistance.printStats(out, names[c]);
+    }
+  }
+}
+
+#endif
@@ -17,14 +17,82 @@ struct SimulationStats
     uint32_t icMisses;
     uint32_t dcHits;
     uint32_t dcMisses;
+    //Only filled in when an L2 is configured; printSimStats does not print
+    //them, see cache_stats.out.
+    uint32_t l2Hits;
+    uint32_t l2Misses;
+    //Instructions that passed ID (see runInstructions); not printed either.
+    uint32_t instructions;
 };
 
 //Implemented in UtilityFunctions.o
 int dumpPipeState(PipeState & state);
 int printSimStats(SimulationStats & stats);
 
-//You must implement the following functions.
+//You must implement the following functions. initSimulator returns -EINVAL
+//if a config fails checkCacheConfig (see CacheModel.h): the cache and block
+//sizes and the ways must be powers of two, with at least one set,
+//sectorSize and busWidth must divide the block, and a block has at most 32
+//sectors.
 int initSimulator(CacheConfig & icConfig, CacheConfig & dcConfig, MemoryStore *mainMem);
 int runCycles(uint32_t cycles);
 int runTillHalt();
 int finalizeSimulator();
+
+//Optional: puts a unified L2 behind both L1 caches; call after initSimulator.
+//An L1 miss then stalls for l2Config.hitLatency cycles, plus
+//l2Config.missLatency more if it misses in the L2 as well. Returns -EINVAL if
+//the config is invalid as for initSimulator, or the L2 blocks are smaller
+//than the L1 blocks.
+int initL2Cache(CacheConfig & l2Config);
+
+//Optional: has the caches of later initSimulator, initL2Cache and
+//initMulticore calls move whole blocks to and from memory with read and write,
+//for a store that can copy a block directly. By default (or given NULL) a
+//block costs a getMemValue or setMemValue call per word, as the store in
+//UtilityFunctions.o offers nothing faster.
+int setBlockTransfer(BlockReadFn read, BlockWriteFn write);
+
+//Optional: records every L1 cache access (address, size, read/write, I/D, PC
+//and cycle) to a binary trace at path until finalizeSimulator, for replay by
+//cache_sim. Returns 0, or -errno if the file cannot be created.
+int traceAccesses(const char *path);
+
+//Optional: runs the program functionally, without timing, for up to
+//instructions instructions or until the one at stopPC is next (0xffffffff for
+//no marker); the pipeline then starts empty from there. A branch and its delay
+//slot run together. Stops early, before it, at the 0xfeedfeed halt or an
+//instruction that would raise an exception. With warmCaches the accesses go
+//through the caches, which the detailed run then starts with (their
+//cache_stats.out counters include these accesses); otherwise they go straight
+//to memory, so keep it the same over calls. Call after initSimulator and
+//initL2Cache, before any cycle runs. Returns the number of instructions run,
+//or -EINVAL once cycles have run.
+int fastForward(uint32_t instructions, uint32_t stopPC, bool warmCaches);
+
+//Optional: runs until instructions more instructions have passed ID, not
+//counting the bubbles of stalls and squashes, or until the halt. Returns 1 if
+//the halt was reached, otherwise 0. Pipe state is not dumped.
+int runInstructions(uint32_t instructions);
+
+//Optional: fills stats with the counters finalizeSimulator would print now.
+int getSimulationStats(SimulationStats & stats);
+
+//Optional: simulates nCores (2 to 8) pipelines, each with a private iCache
+//and dCache, sharing mainMem. The dCaches are kept coherent by snooping MESI.
+//Every core starts at address 0 with $a0 holding its core number and $a1 the
+//number of cores. Use instead of initSimulator and initL2Cache. Returns
+//-EINVAL for a bad core count or cache config, or a dCache with a victim
+//buffer, write buffer or stream prefetcher, which are not snooped.
+int initMulticore(uint32_t nCores, CacheConfig & icConfig, CacheConfig & dcConfig, MemoryStore *mainMem);
+
+//Runs every core until all have halted, spread over up to threads host
+//threads (0 means one per core). No core runs more than quantum cycles ahead
+//of another. With one thread the run is deterministic.
+int runMulticoreTillHalt(uint32_t quantum, uint32_t threads);
+
+//Writes sim_stats.out with the slowest core's cycles and the summed hit
+//counts, cache_stats.out with every cache's counters, core_state.out with
+//every core's registers, and reg_state.out (core 0) and mem_state.out as
+//finalizeSimulator does.
+int finalizeMulticore();
@@ -1,3 +1,6 @@
+#ifndef MEMORY_STORE_H
+#define MEMORY_STORE_H
+
 #include <inttypes.h>
 
 //The memory is 64 KB large.
@@ -21,10 +24,59 @@ class MemoryStore
         virtual int setMemValue(uint32_t address, uint32_t value, MemEntrySize size) = 0;
         virtual int printMemory(uint32_t startAddress, uint32_t endAddress) = 0;
         virtual ~MemoryStore() {}
+
+        //Bulk transfers of nWords consecutive words starting at a word-aligned address,
+        //used to move whole cache blocks. These are deliberately not virtual: the
+        //implementation in UtilityFunctions.o was built against the three virtual
+        //entry points above, so adding slots to the vtable would break it.
+        int readBlock(uint32_t address, uint32_t *dst, uint32_t nWords)
+        {
+            for(uint32_t i = 0 ; i < nWords ; i++)
+            {
+                int ret = getMemValue(address + i * WORD_SIZE, dst[i], WORD_SIZE);
+                if(ret)
+                {
+                    return ret;
+                }
+            }
+            return 0;
+        }
+
+        int writeBlock(uint32_t address, const uint32_t *src, uint32_t nWords)
+        {
+            for(uint32_t i = 0 ; i < nWords ; i++)
+            {
+                int ret = setMemValue(address + i * WORD_SIZE, src[i], WORD_SIZE);
+                if(ret)
+                {
+                    return ret;
+                }
+            }
+            return 0;
+        }
 };
 
+//Moves nWords words between a store and a buffer in one call. The caches reach
+//memory through a pair of these, so a store that can copy a block directly
+//is used without a virtual call per word (see setBlockTransfer).
+typedef int (*BlockReadFn)(MemoryStore *mem, uint32_t address, uint32_t *dst, uint32_t nWords);
+typedef int (*BlockWriteFn)(MemoryStore *mem, uint32_t address, const uint32_t *src, uint32_t nWords);
+
+//The default pair: word by word through the virtual accessors.
+static inline int wordBlockRead(MemoryStore *mem, uint32_t address, uint32_t *dst, uint32_t nWords)
+{
+    return mem->readBlock(address, dst, nWords);
+}
+
+static inline int wordBlockWrite(MemoryStore *mem, uint32_t address, const uint32_t *src, uint32_t nWords)
+{
+    return mem->writeBlock(address, src, nWords);
+}
+
 //Creates a memory store.
 extern MemoryStore *createMemoryStore();
 
 //Dumps the section of memory relevant for the test.
 extern void dumpMemoryState(MemoryStore *mem);
+
+#endif
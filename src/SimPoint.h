@@ -0,0 +1,286 @@
+#ifndef SIMPOINT_H
+#define SIMPOINT_H
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <math.h>
+#include <errno.h>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <utility>
+#include <algorithm>
+
+// SimPoint-style phase analysis (Sherwood et al.) of the basic-block vectors
+// ./sim writes. Every interval's vector is scaled to sum to one, randomly
+// projected down to SIMPOINT_DIMS dimensions and clustered with k-means for
+// each k up to a limit. The smallest k scoring within 90% of the best BIC is
+// kept, and the interval nearest each centroid stands for its cluster,
+// weighted by the share of the program's instructions the cluster ran.
+
+#define SIMPOINT_DIMS 15
+// k-means runs from this many random starts per k, keeping the tightest
+#define SIMPOINT_RESTARTS 5
+#define SIMPOINT_ITERATIONS 100
+
+// One interval: the instructions run in each basic block it entered, by
+// block id
+typedef std::vector<std::pair<uint32_t, uint32_t> > BasicBlockVector;
+
+struct SimPoint {
+  // Interval number, counting from 0, so it starts interval * length
+  // instructions into the run
+  uint32_t interval;
+  uint32_t cluster;
+  double weight;
+};
+
+// Reads the vectors of a basic-block vector file, one per "T:id:count ..."
+// line. Returns 0, or -errno.
+static inline int loadBBVs(const char *path, std::vector<BasicBlockVector> & bbvs) {
+  std::ifstream in(path);
+  if (!in) {
+    return -ENOENT;
+  }
+  std::string line;
+  while (getline(in, line)) {
+    if (line.empty() || line[0] != 'T') {
+      continue;
+    }
+    BasicBlockVector bbv;
+    const char *p = line.c_str() + 1;
+    uint32_t id, count;
+    int used;
+    while (sscanf(p, " :%u:%u%n", &id, &count, &used) == 2) {
+      bbv.push_back(std::make_pair(id, count));
+      p += used;
+    }
+    bbvs.push_back(bbv);
+  }
+  return 0;
+}
+
+// Instructions an interval ran
+static inline uint64_t bbvInstructions(const BasicBlockVector & bbv) {
+  uint64_t total = 0;
+  for (uint32_t i = 0; i < bbv.size(); i++) {
+    total += bbv[i].second;
+  }
+  return total;
+}
+
+// xorshift32, so that a seed always picks the same simulation points
+static inline uint32_t simPointRandom(uint32_t & state) {
+  state ^= state << 13;
+  state ^= state >> 17;
+  state ^= state << 5;
+  return state;
+}
+
+static inline double squaredDistance(const std::vector<double> & a, const std::vector<double> & b) {
+  double d = 0;
+  for (uint32_t i = 0; i < a.size(); i++) {
+    d += (a[i] - b[i]) * (a[i] - b[i]);
+  }
+  return d;
+}
+
+// Scales each vector to sum to one and projects it onto SIMPOINT_DIMS
+// random directions, each block id getting a row of uniform values in
+// [-1, 1)
+static inline std::vector<std::vector<double> > projectBBVs(const std::vector<BasicBlockVector> & bbvs,
+                                                            uint32_t seed) {
+  uint32_t maxId = 0;
+  for (uint32_t i = 0; i < bbvs.size(); i++) {
+    for (uint32_t b = 0; b < bbvs[i].size(); b++) {
+      maxId = std::max(maxId, bbvs[i][b].first);
+    }
+  }
+  std::vector<double> matrix((maxId + 1) * SIMPOINT_DIMS);
+  uint32_t state = seed ? seed : 1;
+  for (uint32_t i = 0; i < matrix.size(); i++) {
+    matrix[i] = simPointRandom(state) / 2147483648.0 - 1.0;
+  }
+
+  std::vector<std::vector<double> > points(bbvs.size(), std::vector<double>(SIMPOINT_DIMS, 0.0));
+  for (uint32_t i = 0; i < bbvs.size(); i++) {
+    double total = bbvInstructions(bbvs[i]);
+    for (uint32_t b = 0; b < bbvs[i].size() && total > 0; b++) {
+      const double *row = &matrix[bbvs[i][b].first * SIMPOINT_DIMS];
+      double share = bbvs[i][b].second / total;
+      for (uint32_t d = 0; d < SIMPOINT_DIMS; d++) {
+        points[i][d] += share * row[d];
+      }
+    }
+  }
+  return points;
+}
+
+struct KMeansResult {
+  std::vector<uint32_t> assignment;
+  std::vector<std::vector<double> > centroids;
+  // Summed squared distance of the points to their centroids
+  double distortion;
+  double bic;
+};
+
+// Bayesian information criterion of a clustering, modelling each cluster as
+// a spherical Gaussian sharing one variance (Pelleg and Moore's X-means)
+static inline double clusteringBIC(const KMeansResult & result, uint32_t points) {
+  uint32_t k = result.centroids.size();
+  double R = points;
+  double M = SIMPOINT_DIMS;
+  double variance = (points > k) ? result.distortion / (M * (R - k)) : 0;
+  variance = std::max(variance, 1e-12);
+  std::vector<uint32_t> sizes(k, 0);
+  for (uint32_t i = 0; i < points; i++) {
+    sizes[result.assignment[i]]++;
+  }
+  double likelihood = -R * M / 2 * log(2 * M_PI * variance) - result.distortion / (2 * variance);
+  for (uint32_t c = 0; c < k; c++) {
+    if (sizes[c]) {
+      likelihood += sizes[c] * log(sizes[c] / R);
+    }
+  }
+  double parameters = (k - 1) + M * k + 1;
+  return likelihood - parameters / 2 * log(R);
+}
+
+// Lloyd's k-means from k-means++ starting centroids
+static inline KMeansResult kMeans(const std::vector<std::vector<double> > & points, uint32_t k,
+                                  uint32_t & state) {
+  uint32_t n = points.size();
+  KMeansResult result;
+  result.assignment.assign(n, 0);
+
+  // Each further centroid is a point picked with probability proportional to
+  // its squared distance from the nearest one so far
+  result.centroids.push_back(points[simPointRandom(state) % n]);
+  std::vector<double> nearest(n);
+  for (uint32_t i = 0; i < n; i++) {
+    nearest[i] = squaredDistance(points[i], result.centroids[0]);
+  }
+  while (result.centroids.size() < k) {
+    double total = 0;
+    for (uint32_t i = 0; i < n; i++) {
+      total += nearest[i];
+    }
+    uint32_t pick = simPointRandom(state) % n;
+    if (total > 0) {
+      double target = simPointRandom(state) / 4294967296.0 * total;
+      for (pick = 0; pick < n - 1 && target >= nearest[pick]; pick++) {
+        target -= nearest[pick];
+      }
+    }
+    result.centroids.push_back(points[pick]);
+    for (uint32_t i = 0; i < n; i++) {
+      nearest[i] = std::min(nearest[i], squaredDistance(points[i], points[pick]));
+    }
+  }
+
+  for (uint32_t iteration = 0; iteration < SIMPOINT_ITERATIONS; iteration++) {
+    bool changed = (iteration == 0);
+    for (uint32_t i = 0; i < n; i++) {
+      uint32_t best = 0;
+      for (uint32_t c = 1; c < k; c++) {
+        if (squaredDistance(points[i], result.centroids[c]) <
+            squaredDistance(points[i], result.centroids[best])) {
+          best = c;
+        }
+      }
+      if (best != result.assignment[i]) {
+        result.assignment[i] = best;
+        changed = true;
+      }
+    }
+    if (!changed) {
+      break;
+    }
+    // An emptied cluster keeps its old centroid
+    std::vector<std::vector<double> > sums(k, std::vector<double>(SIMPOINT_DIMS, 0.0));
+    std::vector<uint32_t> sizes(k, 0);
+    for (uint32_t i = 0; i < n; i++) {
+      sizes[result.assignment[i]]++;
+      for (uint32_t d = 0; d < SIMPOINT_DIMS; d++) {
+        sums[result.assignment[i]][d] += points[i][d];
+      }
+    }
+    for (uint32_t c = 0; c < k; c++) {
+      for (uint32_t d = 0; d < SIMPOINT_DIMS && sizes[c]; d++) {
+        result.centroids[c][d] = sums[c][d] / sizes[c];
+      }
+    }
+  }
+
+  result.distortion = 0;
+  for (uint32_t i = 0; i < n; i++) {
+    result.distortion += squaredDistance(points[i], result.centroids[result.assignment[i]]);
+  }
+  result.bic = clusteringBIC(result, n);
+  return result;
+}
+
+// Clusters the intervals with up to maxK clusters and returns one simulation
+// point per non-empty cluster, in interval order. The weights sum to one.
+static inline std::vector<SimPoint> pickSimPoints(const std::vector<BasicBlockVector> & bbvs, uint32_t maxK,
+                                                  uint32_t seed) {
+  std::vector<SimPoint> simPoints;
+  if (bbvs.empty()) {
+    return simPoints;
+  }
+  std::vector<std::vector<double> > points = projectBBVs(bbvs, seed);
+  maxK = std::max(1u, std::min(maxK, (uint32_t)points.size()));
+
+  uint32_t state = seed ? seed : 1;
+  std::vector<KMeansResult> results;
+  for (uint32_t k = 1; k <= maxK; k++) {
+    KMeansResult best;
+    for (uint32_t r = 0; r < SIMPOINT_RESTARTS; r++) {
+      KMeansResult result = kMeans(points, k, state);
+      if (r == 0 || result.distortion < best.distortion) {
+        best = result;
+      }
+    }
+    results.push_back(best);
+  }
+
+  double lowest = results[0].bic;
+  double highest = results[0].bic;
+  for (uint32_t k = 1; k < results.size(); k++) {
+    lowest = std::min(lowest, results[k].bic);
+    highest = std::max(highest, results[k].bic);
+  }
+  uint32_t chosen = 0;
+  while (results[chosen].bic < lowest + 0.9 * (highest - lowest)) {
+    chosen++;
+  }
+  const KMeansResult & clusters = results[chosen];
+
+  double total = 0;
+  for (uint32_t i = 0; i < bbvs.size(); i++) {
+    total += bbvInstructions(bbvs[i]);
+  }
+  for (uint32_t c = 0; c < clusters.centroids.size(); c++) {
+    SimPoint point = {0, c, 0.0};
+    double closest = -1;
+    for (uint32_t i = 0; i < points.size(); i++) {
+      if (clusters.assignment[i] != c) {
+        continue;
+      }
+      point.weight += total > 0 ? bbvInstructions(bbvs[i]) / total : 0;
+      double d = squaredDistance(points[i], clusters.centroids[c]);
+      if (closest < 0 || d < closest) {
+        closest = d;
+        point.interval = i;
+      }
+    }
+    if (closest >= 0) {
+      simPoints.push_back(point);
+    }
+  }
+  std::sort(simPoints.begin(), simPoints.end(),
+            [](const SimPoint & a, const SimPoint & b) { return a.interval < b.interval; });
+  return simPoints;
+}
+
+#endif
@@ -0,0 +1,95 @@
+#ifndef STACK_DISTANCE_H
+#define STACK_DISTANCE_H
+
+#include <inttypes.h>
+#include <math.h>
+#include <vector>
+#include <algorithm>
+#include <ostream>
+#include "MemoryStore.h"
+
+// LRU stack distance profile of one address stream (Mattson et al.), kept for
+// every power-of-two number of sets at a fixed block size. With 1 << k sets,
+// each set keeps a stack of the blocks mapped to it, most recent first, cut
+// off at maxWays entries. An access found at depth d hits in any LRU cache
+// with that many sets and more than d ways, so a single pass gives the hit
+// ratio of every power-of-two size and associativity up to maxWays.
+struct StackDistance {
+  uint32_t offset_bits;
+  // Deepest stack kept, and so the widest associativity reported. 0 is off.
+  uint32_t maxWays;
+  uint32_t accesses;
+  // stacks[k] holds the (1 << k) stacks of maxWays blocks each back to back,
+  // and depth[k][set] how many entries of a stack are in use
+  std::vector<std::vector<uint32_t> > stacks;
+  std::vector<std::vector<uint32_t> > depth;
+  // hist[k][d] counts the accesses found at depth d with 1 << k sets
+  std::vector<std::vector<uint32_t> > hist;
+
+  void init(uint32_t blockSize, uint32_t ways) {
+    offset_bits = log2(blockSize);
+    maxWays = ways;
+    accesses = 0;
+    uint32_t levels = ways ? log2(MEMORY_SIZE / blockSize) + 1 : 0;
+    stacks.assign(levels, std::vector<uint32_t>());
+    depth.assign(levels, std::vector<uint32_t>());
+    hist.assign(levels, std::vector<uint32_t>());
+    for (uint32_t k = 0; k < levels; k++) {
+      stacks[k].assign((1 << k) * ways, 0);
+      depth[k].assign(1 << k, 0);
+      hist[k].assign(ways, 0);
+    }
+  }
+
+  // Records an access to the block holding memAddress at every set count
+  void access(uint32_t memAddress) {
+    uint32_t block = memAddress >> offset_bits;
+    accesses++;
+    for (uint32_t k = 0; k < stacks.size(); k++) {
+      uint32_t set = block & ((1 << k) - 1);
+      uint32_t *stack = &stacks[k][set * maxWays];
+      uint32_t n = depth[k][set];
+      uint32_t d = 0;
+      while (d < n && stack[d] != block) {
+        d++;
+      }
+      if (d < n) {
+        hist[k][d]++;
+      } else if (n < maxWays) {
+        depth[k][set] = n + 1;
+      } else {
+        // Deeper than any cache reported, so the bottom entry falls off
+        d = n - 1;
+      }
+      std::copy_backward(stack, stack + d, stack + d + 1);
+      stack[0] = block;
+    }
+  }
+
+  // Hits an LRU cache with 1 << k sets and the given ways would have had
+  uint32_t hits(uint32_t k, uint32_t ways) const {
+    uint32_t total = 0;
+    for (uint32_t d = 0; d < ways; d++) {
+      total += hist[k][d];
+    }
+    return total;
+  }
+
+  // Prints a line per cache size and associativity covered, smallest first
+  void printStats(std::ostream & out, const char *name) const {
+    uint32_t blockSize = 1 << offset_bits;
+    out << std::dec << name << " (" << blockSize << "-byte blocks, " << accesses << " accesses)"
+        << std::endl;
+    for (uint32_t size = blockSize; size <= MEMORY_SIZE; size <<= 1) {
+      for (uint32_t ways = 1; ways <= maxWays && ways * blockSize <= size; ways <<= 1) {
+        uint32_t k = log2(size / (ways * blockSize));
+        uint32_t h = hits(k, ways);
+        out << "  size: " << size << ", ways: " << ways << ", sets: " << (1 << k)
+            << ", hits: " << h << ", misses: " << accesses - h
+            << ", hit ratio: " << (accesses ? (double)h / accesses : 0) << std::endl;
+      }
+    }
+  }
+};
+
+#endif
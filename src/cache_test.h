@@ -1,6 +1,10 @@
 #ifndef CACHE_H
 #define CACHE_H
 
+#include <ostream>
+#include "CacheModel.h"
+#include "AddressTrace.h"
+
 enum {
    ICACHE = true,
    DCACHE = false,
@@ -13,4 +17,33 @@ bool cacheAccess(bool isICache, uint32_t memAddress, uint32_t *data, bool isRead
 
 void printStats();
 
+int replayTrace(const char *path);
+
+// An I-cache, D-cache and optional L2 with their hit counters. The functions
+// above drive one global instance; a sweep runs one per worker thread.
+struct CacheSimulator {
+  Cache iCache;
+  Cache dCache;
+  Cache l2Cache;
+  bool l2Enabled;
+
+  uint32_t icHits;
+  uint32_t icMisses;
+  uint32_t dcHits;
+  uint32_t dcMisses;
+
+  // Returns -EINVAL if either config fails checkCacheConfig
+  int init(CacheConfig & icConfig, CacheConfig & dcConfig, MemoryStore *mainMem);
+  // Returns -EINVAL if the config fails checkCacheConfig or the L2 blocks are
+  // smaller than the L1 blocks
+  int initL2(CacheConfig & l2Config, MemoryStore *mainMem);
+  bool access(bool isICache, uint32_t memAddress, uint32_t *data, bool isRead, uint32_t size);
+  // Streams trace records through access(). Stored data is not traced, so
+  // writes store zeros.
+  void replay(const TraceRecord *records, uint32_t count);
+  void printStats(std::ostream & out) const;
+  // Writes back every dirty line, L2 first so the newer L1 copies land on top
+  void writeBackAll();
+};
+
 #endif
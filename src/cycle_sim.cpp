@@ -6,17 +6,25 @@
 
 #include <iostream>
 #include <iomanip>
+#include <fstream>
 #include "MemoryStore.h"
 #include "RegisterInfo.h"
 #include "EndianHelpers.h"
 #include "DriverFunctions.h"
+#include "CacheModel.h"
+#include "AddressTrace.h"
 #include <math.h>
+#include <errno.h>
 #include <vector>
 #include <algorithm>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 
 using namespace std;
 
-/* GLOBAL VARIABLE DEFINITIONS */
+/* TYPE DEFINITIONS */
 
 // Helpful enums for cache accesses
 enum {
@@ -26,66 +34,58 @@ enum {
    WRITE = false
 };
 
-// Represents one cache entry
-struct CacheEntry {
-  bool isValid;
-  uint32_t tag;
-  vector<uint32_t> data;
-  void resize(size_t size) {
-    data.resize(size);
-  }
-  bool isMRU;
+// An outstanding dCache miss
+struct MSHR {
+  uint32_t block;
+  uint32_t readyCycle;
 };
 
-// Represent cache
-struct Cache {
-  // CacheEntry* entries;
-  vector<CacheEntry> entries;
-  void resize(size_t size) {
-    entries.resize(size);
-  }
-  uint32_t tag_bits;
-  uint32_t index_bits;
-  uint32_t block_bits;
-  bool isiCache;
-  uint32_t missLatency;
-  bool isDirect;
+// Pipeline registers
+struct IFID {
+  uint32_t nPC;
+  uint32_t IR;
+  // Address IR was fetched from
+  uint32_t PC;
+  // IR was fetched, rather than left by a squash or after the halt
+  bool fetched;
 };
 
-// Caches
-static Cache dCache;
-static Cache iCache;
-
-// Neccessary for correct cache writeback in the middle of a stall
-static Cache mostRecentICache;
-static Cache mostRecentDCache;
-
-static MemoryStore *myMem;
+struct EXMEM;
 
-static uint32_t reg[32];
-static RegisterInfo regInfo;
+// EX stage work for one kind of instruction: writes ALUOut, and B for
+// stores. Returns false on an arithmetic overflow.
+typedef bool (*ExecuteFn)(uint32_t A, uint32_t B, uint32_t imm, EXMEM & out);
 
-static uint32_t PC = 0x00000000;
-static uint32_t nPC = WORD_SIZE;
-static uint32_t cyclesElapsed = 0;
-static uint32_t PC_cpy = 0x00000000;
+// MicroOp::control
+#define UOP_VALID     0x1
+#define UOP_BRANCH    0x2
+#define UOP_REG_WRITE 0x4
+#define UOP_MEM_READ  0x8
+#define UOP_MEM_WRITE 0x10
 
-// Cache stats
-uint32_t icHits = 0;
-uint32_t icMisses = 0;
-uint32_t dcHits = 0;
-uint32_t dcMisses = 0;
-uint32_t totalCycles = 0;
-bool hit_exception = false;
-
-// Pipeline registers
-struct IFID {
-  uint32_t nPC;
+// An instruction word with its fields pulled out and its control bits worked
+// out, as the decode cache holds it
+struct MicroOp {
+  uint32_t PC;
   uint32_t IR;
+  uint32_t opcode;
+  uint32_t func_code;
+  uint32_t RS;
+  uint32_t RT;
+  uint32_t RD;
+  uint32_t immed;
+  uint32_t seimmed;
+  uint32_t shamt;
+  // The immediate as EX uses it, extended per opcode (shamt for R-types)
+  uint32_t operand;
+  uint32_t control;
+  ExecuteFn execute;
 };
 
 struct IDEX {
   uint32_t IR;
+  // Address IR was fetched from
+  uint32_t PC;
   uint32_t opcode;
   uint32_t func_code;
   uint32_t nPC;
@@ -100,10 +100,17 @@ struct IDEX {
   bool memRead;
   bool regWrite;
   bool insertedNOP;
+  // Carried over from the MicroOp for EX
+  uint32_t operand;
+  uint32_t control;
+  ExecuteFn execute;
 };
 
 struct EXMEM {
   uint32_t IR;
+  // Address IR was fetched from
+  uint32_t PC;
+  uint32_t nPC;
   uint32_t BrTgt;
   uint32_t Zero;
   uint32_t ALUOut;
@@ -122,365 +129,31 @@ struct MEMWB {
   uint32_t regWrite;
 };
 
-// Useful global variable definitions
-static bool receivedIR = false;
-static bool feedfeed_hit = false;
-static bool load_use_stall = false;
-static bool load_use_stall_delay = false;
-static uint32_t load_use_stalls = 0;
-
-static IFID if_id;
-static IDEX id_ex;
-static EXMEM ex_mem;
-static MEMWB mem_wb;
-static IFID if_id_cpy;
-static IDEX id_ex_cpy;
-static EXMEM ex_mem_cpy;
-static MEMWB mem_wb_cpy;
-
-// Various helpers for forwarding/stalling/etc.
-static uint32_t ex_fwd_A = 0;
-static uint32_t ex_fwd_B = 0;
-static uint32_t wb_instruction = 0;
-static uint32_t if_instruction = 0;
-static int iCache_stalls = 0;
-static int dCache_stalls = 0;
-static bool started = false;
-static bool haltReached = false;
-static PipeState mostRecentPS = PipeState();
-
-/* END GLOBAL VARIABLE DEFINITIONS */
-
-/* START OF CACHE SECTION */
-
-// FROM API: Initializes caches, but don't begin exectution
-int initSimulator(CacheConfig & icConfig, CacheConfig & dcConfig, MemoryStore *mainMem)
-{
-  myMem = mainMem;
-  bool iIsDirect = (icConfig.type == DIRECT_MAPPED) ? true : false;
-  bool dIsDirect = (dcConfig.type == DIRECT_MAPPED) ? true : false;
-  int iWays = (icConfig.type == DIRECT_MAPPED) ? 1 : 2;
-  int dWays = (dcConfig.type == DIRECT_MAPPED) ? 1 : 2;
-  int iBlockSize = icConfig.blockSize;
-  int dBlockSize = dcConfig.blockSize;
-
-  // get initialization settings for iCache
-  uint32_t index_size = icConfig.cacheSize / (icConfig.blockSize * iWays);
-  uint32_t index_bits = log2(index_size);
-  uint32_t block_words = iBlockSize / WORD_SIZE;
-  uint32_t block_offset_bits = log2(block_words);
-
-  uint32_t tag_bits = 16 - index_bits - block_offset_bits - 2;
-
-  // initialize iCache
-  iCache.tag_bits = tag_bits;
-  iCache.index_bits = index_bits;
-  iCache.block_bits = block_offset_bits;
-  iCache.isiCache = true;
-  iCache.missLatency = icConfig.missLatency;
-  iCache.isDirect = iIsDirect;
-  iCache.resize(index_size * iWays);
-  for (int i = 0; i < index_size * iWays; i++) {
-    iCache.entries[i].resize(block_words);
-  }
-
-  // get initialization settings for dCache
-  index_size = dcConfig.cacheSize / (dBlockSize * dWays);
-  index_bits = log2(index_size);
-  block_words = dBlockSize / WORD_SIZE;
-  block_offset_bits = log2(block_words);
-  tag_bits = 16 - index_bits - block_offset_bits - 2;
-
-  // initialize dCache
-  dCache.tag_bits = tag_bits;
-  dCache.index_bits = index_bits;
-  dCache.block_bits = block_offset_bits;
-  dCache.isiCache = false;
-  dCache.missLatency = dcConfig.missLatency;
-  dCache.isDirect = dIsDirect;
-  dCache.resize(index_size * dWays);
-  for (int i = 0; i < index_size * dWays; i++) {
-    dCache.entries[i].resize(block_words);
-  }
-
-  return 0;
-}
-
-// Dump registers and memory
-static void dump(MemoryStore* mem, uint32_t* myreg) {
-   RegisterInfo regs;
-
-   regs.at = myreg[1];
-   copy(myreg+2, myreg+4, regs.v);
-   copy(myreg+4, myreg+8, regs.a);
-   copy(myreg+8, myreg+16, regs.t);
-   copy(myreg+16, myreg+24, regs.s);
-   regs.t[8] = myreg[24];
-   regs.t[9] = myreg[25];
-   copy(myreg+24, myreg+26, regs.k);
-   regs.gp = myreg[28];
-   regs.sp = myreg[29];
-   regs.fp = myreg[30];
-   regs.ra = myreg[31];
-
-   dumpRegisterState(regs);
-   dumpMemoryState(mem);
-}
-
-// FROM API: finalize execution
-int finalizeSimulator() {
-   // Print simulation stats to sim_stats.out file
-   SimulationStats final_stats;
-   if (!started) {
-     final_stats.totalCycles = 0;
-   }
-   else {
-     final_stats.totalCycles = cyclesElapsed+1;
-   }
-   final_stats.icHits = icHits;
-   final_stats.icMisses = icMisses;
-   final_stats.dcHits = dcHits;
-   final_stats.dcMisses = dcMisses;
-   printSimStats(final_stats);
-
-   // Write back all dirty values in the iCache to memory
-   uint32_t block_size = 1 << mostRecentICache.block_bits;
-   for (int i = 0; i < mostRecentICache.entries.size(); i++) {
-      if (iCache.entries[i].isValid) {
-         uint32_t first_block_address = mostRecentICache.entries[i].tag << mostRecentICache.index_bits;
-         if (mostRecentICache.isDirect)
-            first_block_address |= i;
-         else
-            first_block_address |= (i >> 1);
-         first_block_address <<= mostRecentICache.block_bits + 2;
-         for (int j = 0; j < block_size; j++) {
-            myMem->setMemValue(first_block_address + 4 * j, mostRecentICache.entries[i].data[j], WORD_SIZE);
-         }
-      }
-   }
-
-   // Write back all dirty values in the dCache to memory
-   block_size = 1 << mostRecentDCache.block_bits;
-   for (int i = 0; i < mostRecentDCache.entries.size(); i++) {
-      if (mostRecentDCache.entries[i].isValid) {
-         uint32_t first_block_address = mostRecentDCache.entries[i].tag << mostRecentDCache.index_bits;
-         if (mostRecentDCache.isDirect)
-            first_block_address |= i;
-         else
-            first_block_address |= (i >> 1);
-         first_block_address <<= mostRecentDCache.block_bits + 2;
-         for (int j = 0; j < block_size; j++) {
-            myMem->setMemValue(first_block_address + 4 * j, mostRecentDCache.entries[i].data[j], WORD_SIZE);
-         }
-      }
-   }
-
-   // Dump memory
-   dump(myMem, reg);
-}
-
-// Evicts the block at the index from the cache, writing it back (write-through)
-static void evict_block(bool isICache, uint32_t index) {
-
-  Cache* cache = isICache ? &iCache : &dCache;
-  uint32_t block_size = 1 << cache->block_bits;
-
-  uint32_t first_block_address = cache->entries[index].tag << cache->index_bits;
-  if (cache->isDirect)
-     first_block_address |= index;
-  else
-     first_block_address |= (index >> 1);
-  first_block_address <<= cache->block_bits + 2;
-
-  for (int i = 0; i < block_size; i++) {
-    myMem->setMemValue(first_block_address + 4 * i, cache->entries[index].data[i], WORD_SIZE);
-  }
-}
-
-// Reads in a block of memory into the cache
-static void read_from_mem(bool isICache, uint32_t index, uint32_t size) {
-
-  Cache* cache = isICache ? &iCache : &dCache;
-  uint32_t block_size = 1 << cache->block_bits;
-  uint32_t first_block_address = cache->entries[index].tag << cache->index_bits;
-  if (cache->isDirect)
-     first_block_address |= index;
-  else
-     first_block_address |= (index >> 1);
-  first_block_address <<= cache->block_bits + 2;
-
-  for (int i = 0; i < block_size; i++) {
-     myMem->getMemValue(first_block_address + 4 * i, cache->entries[index].data[i], (MemEntrySize)size);
-  }
-}
-
-// Handles all cache accesses
-static bool cacheAccess(bool isICache, uint32_t memAddress, uint32_t *data, bool isRead, uint32_t size)
-{
-  Cache* cache = isICache ? &iCache : &dCache;
-
-  // first figure out the index
-  uint32_t index = memAddress >> 2 >> cache->block_bits;
-  uint32_t bitmask = (1 << cache->index_bits) - 1;
-  index = index & bitmask;
-
-  uint32_t tag = memAddress >> (cache->block_bits + cache->index_bits + 2);
-  index *= ((cache->isDirect) ? 1 : 2);
-
-  uint32_t block_offset = memAddress >> 2;
-  bitmask = (1 << cache->block_bits) - 1;
-  block_offset &= bitmask;
-
-  // Bit bashing to allow for half/byte reads/writes
-  uint32_t byte_offset = memAddress & 0x3;
-  uint32_t byte_mask = (size == WORD_SIZE) ? 0xffffffff : (0x1 << (8*size)) - 1;
-  uint32_t byte_shift = 32 - 8 * (byte_offset + size);
-
-  // Direct-mapped case
-  if (cache->isDirect) {
-    // handles read hit
-    if (cache->entries[index].isValid && cache->entries[index].tag == tag) {
-      if (isICache) icHits++;
-      else dcHits++;
-
-      if (isRead) {
-         // Read data into the value pointer
-         *data = ((cache->entries[index].data[block_offset] >> byte_shift) & byte_mask);
-      } else {
-         // Clear the data, then write over it
-         cache->entries[index].data[block_offset] &= ~(byte_mask << byte_shift);
-         cache->entries[index].data[block_offset] |= (*data << byte_shift);
-      }
-      return true;
-    } else {
-      if (isICache) icMisses++;
-      else dcMisses++;
-      
-      // if valid, evict existing block and write to memory
-      if (cache->entries[index].isValid) {
-        evict_block(isICache, index);
-      }
-
-      // read from memAddress to cache
-      cache->entries[index].tag = tag;
-      read_from_mem(isICache, index, WORD_SIZE);
-
-      // read from cache into data
-      cache->entries[index].isValid = true;
-      if (isRead) {
-        *data = ((cache->entries[index].data[block_offset] >> byte_shift) & byte_mask);
-      } else {
-         cache->entries[index].data[block_offset] &= ~(byte_mask << byte_shift);
-         cache->entries[index].data[block_offset] |= (*data << byte_shift);
-      }
-      return false;
-    }
-    // Two-way set associative case
-  } else {
-    // cache hit with first block in set
-    if (cache->entries[index].isValid && cache->entries[index].tag == tag) {
-      if (isICache) icHits++;
-      else dcHits++;
-      if (isRead) {
-        *data = ((cache->entries[index].data[block_offset] >> byte_shift) & byte_mask);
-      } else {
-         cache->entries[index].data[block_offset] &= ~(byte_mask << byte_shift);
-         cache->entries[index].data[block_offset] |= (*data << byte_shift);
-      }
-
-      cache->entries[index].isMRU = true;
-      cache->entries[index + 1].isMRU = false;
-
-      return true;
-    // cache hit with second block in set
-    } else if (cache->entries[index + 1].isValid && cache->entries[index + 1].tag == tag) {
-      if (isICache) icHits++;
-      else dcHits++;
-      if (isRead) {
-        *data = ((cache->entries[index + 1].data[block_offset] >> byte_shift) & byte_mask);
-      } else {
-         cache->entries[index + 1].data[block_offset] &= ~(byte_mask << byte_shift);
-         cache->entries[index + 1].data[block_offset] |= (*data << byte_shift);
-      }
-
-      cache->entries[index].isMRU = false;
-      cache->entries[index + 1].isMRU = true;
-      return true;
-      // cache miss
-    } else {
-      if (isICache) icMisses++;
-      else dcMisses++;
-      // find index of block in the set that is LRU to evict
-      int LRU = (cache->entries[index].isMRU) ? 1 : 0;
-
-      // write every other entry in cache.entries to memory
-      if (cache->entries[index + LRU].isValid) {
-        evict_block(isICache, index + LRU);
-      }
-      // read from memAddress to cache
-      cache->entries[index + LRU].tag = tag;
-      read_from_mem(isICache, index + LRU, WORD_SIZE);
-
-      // read from cache into data
-      cache->entries[index + LRU].isValid = true;
-      if (isRead) {
-         *data = ((cache->entries[index + LRU].data[block_offset] >> byte_shift) & byte_mask);
-      } else {
-         cache->entries[index + LRU].data[block_offset] &= ~(byte_mask << byte_shift);
-         cache->entries[index + LRU].data[block_offset] |= (*data << byte_shift);
-      }
-
-      // set MRU bit for both blocks in the set
-      cache->entries[index + LRU].isMRU = true;
-      int MRU = (LRU == 1) ? 0 : 1;
-      cache->entries[index + MRU].isMRU = false;
+// One copy of every pipeline register, a cache line to itself
+struct alignas(64) Latches {
+  IFID if_id;
+  IDEX id_ex;
+  EXMEM ex_mem;
+  MEMWB mem_wb;
+};
 
-      return false;
-    }
-  }
-}
+/* END TYPE DEFINITIONS */
 
-/* END OF CACHE SECTION */
+// Serializes coherence traffic and memory between the cores of a multicore
+// run: held for dCache misses, upgrades and the write-backs they cause, and
+// for iCache accesses that may reach memory. Taken before any dCache lock.
+static mutex busLock;
 
-/* START OF PIPELINE SECTION */
+// How every cache initialized from now on moves blocks to and from memory
+static BlockReadFn blockRead = wordBlockRead;
+static BlockWriteFn blockWrite = wordBlockWrite;
 
-// advance PC function
-static void advance_pc(uint32_t offset)
-{
-  PC  += offset;
-}
+// Entries in each core's decode cache, a power of two
+#define DECODE_CACHE_ENTRIES 1024
+// Decode cache tag of an empty entry; no fetch address matches it
+#define DECODE_NO_PC 0xffffffff
 
-// Handles exceptions when they arise
-static void handleException(bool isArithmetic) {
-  hit_exception = true;
-
-  // Squash the instruction going into EX stage
-  id_ex.opcode = 0;
-  id_ex.func_code = 0;
-  id_ex.nPC = 0;
-  id_ex.RS = 0;
-  id_ex.RT = 0;
-  id_ex.RD = 0;
-  id_ex.immed = 0;
-  id_ex.A = 0;
-  id_ex.B = 0;
-  id_ex.seimmed = 0;
-
-  if (isArithmetic) {
-     // Squash instruction going into MEM stage if arithmetic exception
-    ex_mem.BrTgt = 0;
-    ex_mem.Zero = 0;
-    ex_mem.ALUOut = 0;
-    ex_mem.RD = 0;
-    ex_mem.B = 0;
-    ex_mem.regWrite = 0;
-    ex_mem.memWrite = 0;
-    ex_mem.memRead = 0;
-    ex_mem.IR = 0;
-  }
-  PC = 0x8000;
-  nPC = PC + WORD_SIZE;
-}
+/* START OF DECODE HELPERS */
 
 // Determines if an instruction is writing to a register
 static bool isRegWrite(uint32_t opcode, uint32_t func_code) {
@@ -725,831 +398,1670 @@ static bool isValidInstruction(uint32_t opcode, uint32_t func_code) {
 
 }
 
-// HANDLE THE IF SECTION
-static void ifSection() {
-    uint32_t instruction = 0;
+/* END OF DECODE HELPERS */
 
-    // Now we are no longer fetching instructions until the load-use stall is over
-    if (load_use_stall_delay) {
-      load_use_stalls = load_use_stalls - 1;
-      if (load_use_stalls == 0) {
-        load_use_stall_delay = false;
-        if_id.IR = if_instruction;
-        PC_cpy = PC;
+/* START OF EXECUTE HANDLERS */
+
+// Instructions EX does nothing for: branches, jumps and unknown functions
+static bool executeNone(uint32_t, uint32_t, uint32_t, EXMEM &) {
+  return true;
+}
+
+// Signed add, failing when both operands have one sign and the sum the other
+static bool executeAdd(uint32_t A, uint32_t B, uint32_t, EXMEM & out) {
+  uint32_t res = (uint32_t)((int)A + (int)B);
+  if ((A >> 31) == (B >> 31) && (res >> 31) != (A >> 31)) {
+    return false;
+  }
+  out.ALUOut = res;
+  return true;
+}
+
+static bool executeAddu(uint32_t A, uint32_t B, uint32_t, EXMEM & out) {
+  out.ALUOut = A + B;
+  return true;
+}
+
+static bool executeAnd(uint32_t A, uint32_t B, uint32_t, EXMEM & out) {
+  out.ALUOut = A & B;
+  return true;
+}
+
+static bool executeNor(uint32_t A, uint32_t B, uint32_t, EXMEM & out) {
+  out.ALUOut = ~(A | B);
+  return true;
+}
+
+static bool executeOr(uint32_t A, uint32_t B, uint32_t, EXMEM & out) {
+  out.ALUOut = A | B;
+  return true;
+}
+
+static bool executeSlt(uint32_t A, uint32_t B, uint32_t, EXMEM & out) {
+  out.ALUOut = ((int)A < (int)B) ? 1 : 0;
+  return true;
+}
+
+static bool executeSltu(uint32_t A, uint32_t B, uint32_t, EXMEM & out) {
+  out.ALUOut = (A < B) ? 1 : 0;
+  return true;
+}
+
+static bool executeSll(uint32_t, uint32_t B, uint32_t shamt, EXMEM & out) {
+  out.ALUOut = (B << shamt);
+  return true;
+}
+
+static bool executeSrl(uint32_t, uint32_t B, uint32_t shamt, EXMEM & out) {
+  out.ALUOut = (B >> shamt);
+  return true;
+}
+
+// Signed subtract, failing when the operands' signs differ and the result's
+// differs from the first operand's
+static bool executeSub(uint32_t A, uint32_t B, uint32_t, EXMEM & out) {
+  uint32_t res = (uint32_t)((int)A - (int)B);
+  if ((A >> 31) != (B >> 31) && (res >> 31) != (A >> 31)) {
+    return false;
+  }
+  out.ALUOut = res;
+  return true;
+}
+
+static bool executeSubu(uint32_t A, uint32_t B, uint32_t, EXMEM & out) {
+  out.ALUOut = A - B;
+  return true;
+}
+
+static bool executeAddi(uint32_t A, uint32_t, uint32_t imm, EXMEM & out) {
+  return executeAdd(A, imm, 0, out);
+}
+
+// addiu, and the address of a load
+static bool executeAddiu(uint32_t A, uint32_t, uint32_t imm, EXMEM & out) {
+  out.ALUOut = A + imm;
+  return true;
+}
+
+static bool executeAndi(uint32_t A, uint32_t, uint32_t imm, EXMEM & out) {
+  out.ALUOut = A & imm;
+  return true;
+}
+
+static bool executeOri(uint32_t A, uint32_t, uint32_t imm, EXMEM & out) {
+  out.ALUOut = A | imm;
+  return true;
+}
+
+static bool executeSlti(uint32_t A, uint32_t, uint32_t imm, EXMEM & out) {
+  out.ALUOut = ((int)A < (int)imm) ? 1 : 0;
+  return true;
+}
+
+static bool executeSltiu(uint32_t A, uint32_t, uint32_t imm, EXMEM & out) {
+  out.ALUOut = (A < imm) ? 1 : 0;
+  return true;
+}
+
+// The immediate comes already shifted into the upper half
+static bool executeLui(uint32_t, uint32_t, uint32_t imm, EXMEM & out) {
+  out.ALUOut = imm;
+  return true;
+}
+
+static bool executeSb(uint32_t A, uint32_t B, uint32_t imm, EXMEM & out) {
+  out.ALUOut = A + imm;
+  out.B = B & (0x000000ff);
+  return true;
+}
+
+static bool executeSh(uint32_t A, uint32_t B, uint32_t imm, EXMEM & out) {
+  out.B = B & (0x0000ffff);
+  out.ALUOut = A + imm;
+  return true;
+}
+
+static bool executeSw(uint32_t A, uint32_t B, uint32_t imm, EXMEM & out) {
+  out.B = B;
+  out.ALUOut = A + imm;
+  return true;
+}
+
+// Picks the EX handler for an R-type instruction
+static ExecuteFn rTypeHandler(uint32_t func_code) {
+  switch (func_code) {
+    case 0x20: return executeAdd;
+    case 0x21: return executeAddu;
+    case 0x24: return executeAnd;
+    case 0x27: return executeNor;
+    case 0x25: return executeOr;
+    case 0x2a: return executeSlt;
+    case 0x2b: return executeSltu;
+    case 0x00: return executeSll;
+    case 0x02: return executeSrl;
+    case 0x22: return executeSub;
+    case 0x23: return executeSubu;
+    default: return executeNone;
+  }
+}
+
+// Decodes instruction, fetched from pc, once for the decode cache
+static MicroOp decodeInstr(uint32_t pc, uint32_t instruction) {
+  MicroOp op;
+  op.PC = pc;
+  op.IR = instruction;
+  op.opcode = instruction >> 26;
+  op.RS = instruction << 6 >> 27;
+  op.RT = instruction << 11 >> 27;
+  op.RD = instruction << 16 >> 27;
+  op.func_code = instruction & (63);
+  op.immed = instruction << 16 >> 16;
+  op.shamt = instruction << 21 >> 27;
+  op.seimmed = (op.immed >> 15 == 0) ? op.immed : (op.immed | 0xffff0000);
+
+  op.control = 0;
+  if (isValidInstruction(op.opcode, op.func_code)) {
+    op.control |= UOP_VALID;
+  }
+  if (((op.opcode >= 0x2) && (op.opcode <= 0x7)) || ((op.opcode == 0) && (op.func_code == 0x8))) {
+    op.control |= UOP_BRANCH;
+  }
+  if (isRegWrite(op.opcode, op.func_code)) {
+    op.control |= UOP_REG_WRITE;
+  }
+  if (isMemRead(op.opcode)) {
+    op.control |= UOP_MEM_READ;
+  }
+  if (isMemWrite(op.opcode)) {
+    op.control |= UOP_MEM_WRITE;
+  }
+
+  op.operand = op.seimmed;
+  switch (op.opcode) {
+    case 0:
+      op.operand = op.shamt;
+      op.execute = rTypeHandler(op.func_code);
+      break;
+    case 0x8: op.execute = executeAddi; break;
+    case 0x9: op.execute = executeAddiu; break;
+    case 0xc: op.operand = op.immed; op.execute = executeAndi; break;
+    case 0xd: op.operand = op.immed; op.execute = executeOri; break;
+    case 0xa: op.execute = executeSlti; break;
+    case 0xb: op.execute = executeSltiu; break;
+    case 0xf: op.operand = op.immed << 16; op.execute = executeLui; break;
+    case 0x23: op.execute = executeAddiu; break;
+    // lbu and lhu extend the offset's sign bit only to bit 18
+    case 0x24:
+    case 0x25:
+      op.operand = (op.immed >> 15 == 0) ? op.immed : (op.immed | 0xfffc0000);
+      op.execute = executeAddiu;
+      break;
+    case 0x28: op.execute = executeSb; break;
+    case 0x29: op.execute = executeSh; break;
+    case 0x2b: op.execute = executeSw; break;
+    default: op.execute = executeNone; break;
+  }
+  return op;
+}
+
+// The ID/EX contents of a bubble: all zeroes, which EX runs as sll $0,$0,0
+static IDEX makeBubble() {
+  IDEX bubble = IDEX();
+  MicroOp nop = decodeInstr(0, 0);
+  bubble.operand = nop.operand;
+  bubble.control = nop.control;
+  bubble.execute = nop.execute;
+  return bubble;
+}
+
+static const IDEX bubble = makeBubble();
+
+/* END OF EXECUTE HANDLERS */
+
+// One simulated core: its pipeline, register file and private caches, and
+// the counters sim_stats.out reports. The single-core API below drives
+// mainCore.
+struct Core {
+  /* CORE STATE */
+
+  // Caches
+  Cache dCache;
+  Cache iCache;
+  // Optional unified L2 behind both L1 caches
+  Cache l2Cache;
+  bool l2Enabled = false;
+
+  // Non-blocking dCache: each MSHR tracks the block one outstanding miss is
+  // fetching and the cycle its data arrives. regReady holds the cycle a load's
+  // destination register can first be read in ID.
+  std::vector<MSHR> mshrs;
+  uint32_t regReady[32];
+  uint32_t mshrPrimary = 0;
+  uint32_t mshrMerged = 0;
+  uint32_t mshrFullStalls = 0;
+  uint32_t scoreboardStalls = 0;
+  // Summed miss latency, and cycles with at least one miss outstanding
+  uint32_t missCycles = 0;
+  uint32_t missBusyCycles = 0;
+  uint32_t missBusyUntil = 0;
+
+  // Every L1 access is appended here while a trace is being recorded
+  TraceWriter trace;
+
+  MemoryStore *myMem;
+
+  uint32_t reg[32];
+  RegisterInfo regInfo;
+
+  uint32_t PC = 0x00000000;
+  uint32_t nPC = WORD_SIZE;
+  uint32_t cyclesElapsed = 0;
+  uint32_t PC_cpy = 0x00000000;
+
+  // Cache stats
+  uint32_t icHits = 0;
+  uint32_t icMisses = 0;
+  uint32_t dcHits = 0;
+  uint32_t dcMisses = 0;
+  uint32_t totalCycles = 0;
+  // Instructions that have passed ID, not counting stall bubbles
+  uint32_t instructionsIssued = 0;
+  bool hit_exception = false;
+
+  // Useful global variable definitions
+  bool receivedIR = false;
+  bool feedfeed_hit = false;
+  bool load_use_stall = false;
+  bool load_use_stall_delay = false;
+  uint32_t load_use_stalls = 0;
+  bool scoreboard_stall = false;
+
+  // Double-buffered pipeline registers. Stages read prev, latched at the end
+  // of the last cycle, and write next; latch() swaps the two.
+  Latches latches[2];
+  Latches *prev = &latches[0];
+  Latches *next = &latches[1];
+
+  // Cycles the caches' clocks run ahead of cyclesElapsed: one for each
+  // instruction fast-forwarded through them
+  uint32_t warmCycles = 0;
+  uint32_t fastForwarded = 0;
+
+  // Decoded instructions by the address they were fetched from. An entry is
+  // used only while that address still holds the word it decoded.
+  std::vector<MicroOp> decoded;
+
+  // Various helpers for forwarding/stalling/etc.
+  uint32_t ex_fwd_A = 0;
+  uint32_t ex_fwd_B = 0;
+  uint32_t wb_instruction = 0;
+  uint32_t if_instruction = 0;
+  int iCache_stalls = 0;
+  int dCache_stalls = 0;
+  bool started = false;
+  bool haltReached = false;
+  PipeState mostRecentPS = PipeState();
+  // Set on the cores of a multicore run, whose dCaches snoop each other
+  bool coherent = false;
+
+  /* END CORE STATE */
+
+  /* START OF CACHE SECTION */
+
+  // FROM API: Initializes caches, but don't begin exectution
+  int initSimulator(CacheConfig & icConfig, CacheConfig & dcConfig, MemoryStore *mainMem)
+  {
+    if (checkCacheConfig(icConfig) || checkCacheConfig(dcConfig)) {
+      return -EINVAL;
+    }
+    myMem = mainMem;
+    iCache.init(icConfig, true, mainMem);
+    dCache.init(dcConfig, false, mainMem);
+    iCache.setBlockTransfer(blockRead, blockWrite);
+    dCache.setBlockTransfer(blockRead, blockWrite);
+    // Neccessary for correct cache writeback in the middle of a stall
+    iCache.startJournal();
+    dCache.startJournal();
+    l2Enabled = false;
+    mshrs.assign(dcConfig.mshrs, MSHR());
+    MicroOp empty = MicroOp();
+    empty.PC = DECODE_NO_PC;
+    decoded.assign(DECODE_CACHE_ENTRIES, empty);
+    latches[0].id_ex = bubble;
+    latches[1].id_ex = bubble;
+    warmCycles = 0;
+    fastForwarded = 0;
+    fill(regReady, regReady + 32, 0);
+    scoreboard_stall = false;
+    mshrPrimary = 0;
+    mshrMerged = 0;
+    mshrFullStalls = 0;
+    scoreboardStalls = 0;
+    missCycles = 0;
+    missBusyCycles = 0;
+    missBusyUntil = 0;
+    return 0;
+  }
+
+  // FROM API: Records every L1 access to a binary trace file
+  int traceAccesses(const char *path)
+  {
+    return trace.open(path);
+  }
+
+  // FROM API: Puts a unified L2 behind the L1 caches
+  int initL2Cache(CacheConfig & l2Config)
+  {
+    if (checkCacheConfig(l2Config) || l2Config.blockSize < iCache.blockBytes() || l2Config.blockSize < dCache.blockBytes()) {
+      return -EINVAL;
+    }
+    l2Cache.init(l2Config, false, myMem);
+    l2Cache.setBlockTransfer(blockRead, blockWrite);
+    l2Cache.startJournal();
+    iCache.attach(&l2Cache);
+    dCache.attach(&l2Cache);
+    l2Enabled = true;
+    return 0;
+  }
+
+  // Dump registers and memory
+  void dump(MemoryStore* mem, uint32_t* myreg) {
+     RegisterInfo regs;
+
+     regs.at = myreg[1];
+     copy(myreg+2, myreg+4, regs.v);
+     copy(myreg+4, myreg+8, regs.a);
+     copy(myreg+8, myreg+16, regs.t);
+     copy(myreg+16, myreg+24, regs.s);
+     regs.t[8] = myreg[24];
+     regs.t[9] = myreg[25];
+     copy(myreg+24, myreg+26, regs.k);
+     regs.gp = myreg[28];
+     regs.sp = myreg[29];
+     regs.fp = myreg[30];
+     regs.ra = myreg[31];
+
+     dumpRegisterState(regs);
+     dumpMemoryState(mem);
+  }
+
+  // Prints per-cache statistics that sim_stats.out has no room for
+  void printCacheStats() {
+     ofstream out("cache_stats.out");
+     iCache.printStats(out, "iCache");
+     dCache.printStats(out, "dCache");
+     if (l2Enabled) {
+       l2Cache.printStats(out, "L2");
+     }
+     if (!mshrs.empty()) {
+       out << "dCache MSHRs: " << mshrs.size() << ", primary misses: " << mshrPrimary
+           << ", merged misses: " << mshrMerged << ", MSHR-full stall cycles: " << mshrFullStalls
+           << ", load-use stall cycles: " << scoreboardStalls << ", memory-level parallelism: "
+           << (missBusyCycles ? (double)missCycles / missBusyCycles : 0) << endl;
+     }
+     if (fastForwarded) {
+       out << "Fast-forwarded instructions: " << fastForwarded << (warmCycles ? " (caches warmed)" : "")
+           << endl;
+     }
+
+     Cache *const caches[] = {&iCache, &dCache, &l2Cache};
+     const char *const names[] = {"iCache", "dCache", "L2"};
+     writeProfiles("cache_profile.json", caches, names, l2Enabled ? 3 : 2);
+     writeStackDistances("stack_distance.out", caches, names, l2Enabled ? 3 : 2);
+  }
+
+  // FROM API: the counters sim_stats.out reports so far
+  int getSimulationStats(SimulationStats & stats) {
+     if (!started) {
+       stats.totalCycles = 0;
+     }
+     else {
+       stats.totalCycles = cyclesElapsed+1;
+     }
+     stats.icHits = icHits;
+     stats.icMisses = icMisses;
+     stats.dcHits = dcHits;
+     stats.dcMisses = dcMisses;
+     stats.l2Hits = l2Enabled ? l2Cache.hits : 0;
+     stats.l2Misses = l2Enabled ? l2Cache.misses : 0;
+     stats.instructions = instructionsIssued;
+     return 0;
+  }
+
+  // FROM API: finalize execution
+  int finalizeSimulator() {
+     // Print simulation stats to sim_stats.out file
+     SimulationStats final_stats;
+     getSimulationStats(final_stats);
+     printSimStats(final_stats);
+     printCacheStats();
+
+     // Write back all dirty values in the caches to memory as they stood at the
+     // start of the last cycle that ran, L2 first so the newer L1 copies
+     // overwrite it
+     if (l2Enabled) {
+       l2Cache.rollback();
+       l2Cache.writeBackAll();
+     }
+     iCache.rollback();
+     iCache.writeBackAll();
+     dCache.rollback();
+     dCache.writeBackAll();
+     trace.close();
+
+     // Dump memory
+     dump(myMem, reg);
+     return 0;
+  }
+
+  // Handles all cache accesses. The side, direction and size are template
+  // arguments so each call site gets its own specialized lookup.
+  template <bool IsICache, bool IsRead, uint32_t Size>
+  bool cacheAccess(uint32_t memAddress, uint32_t *data, uint32_t pc)
+  {
+    Cache* cache = IsICache ? &iCache : &dCache;
+    if (trace.isOpen()) {
+      trace.record(memAddress, Size, IsRead, IsICache, pc, cyclesElapsed);
+    }
+    // Hits that need nothing from the other cores stay inside this one,
+    // under the dCache's own lock as the bus holder may snoop it at any
+    // time. Anything else drops that lock, takes the bus and then every
+    // dCache's lock in core order.
+    unique_lock<mutex> bus(busLock, defer_lock);
+    unique_lock<mutex> own;
+    if (coherent && IsICache) {
+      if (cache->prefetcher != PREFETCH_NONE || !cache->holds(memAddress)) {
+        bus.lock();
+      }
+    } else if (coherent) {
+      own = unique_lock<mutex>(cache->lock);
+      if (!cache->hitsLocally(memAddress, IsRead)) {
+        own.unlock();
+        bus.lock();
+        cache->lockCoherent();
+        cache->busAccesses++;
       }
-      return;
+    }
+    cache->now = warmCycles + cyclesElapsed;
+    cache->pc = pc;
+    bool hit = cache->access<IsRead, Size>(memAddress, data);
+    if (!IsICache && bus.owns_lock()) {
+      cache->unlockCoherent();
     }
 
-    // We just hit a load use stall later in the pipeline, so we still need to fetch an insruction
-    if (load_use_stall) {
-      load_use_stall_delay = true;
-      load_use_stall = false;
+    if (IsICache) {
+      if (hit) icHits++;
+      else icMisses++;
+    } else {
+      if (hit) dcHits++;
+      else dcMisses++;
+    }
+    return hit;
+  }
 
-      bool hit = cacheAccess(ICACHE, PC_cpy, &instruction, READ, WORD_SIZE);
-      if (!hit) {
-        iCache_stalls = (iCache_stalls <= iCache.missLatency) ? iCache.missLatency: iCache_stalls;
+  // Dispatches a data access to the specialization for its size
+  bool dCacheAccess(uint32_t memAddress, uint32_t *data, bool isRead, uint32_t size, uint32_t pc)
+  {
+    if (isRead) {
+      switch (size) {
+        case BYTE_SIZE:
+          return cacheAccess<DCACHE, READ, BYTE_SIZE>(memAddress, data, pc);
+        case HALF_SIZE:
+          return cacheAccess<DCACHE, READ, HALF_SIZE>(memAddress, data, pc);
+        default:
+          return cacheAccess<DCACHE, READ, WORD_SIZE>(memAddress, data, pc);
       }
-      if_instruction = instruction;
-      return;
     }
+    switch (size) {
+      case BYTE_SIZE:
+        return cacheAccess<DCACHE, WRITE, BYTE_SIZE>(memAddress, data, pc);
+      case HALF_SIZE:
+        return cacheAccess<DCACHE, WRITE, HALF_SIZE>(memAddress, data, pc);
+      default:
+        return cacheAccess<DCACHE, WRITE, WORD_SIZE>(memAddress, data, pc);
+    }
+  }
 
-    if_id.IR = 0;
-
-    // If we haven't hit 0xfeedfeed, then fetch an insruction
-    if (!feedfeed_hit) {
-      bool hit = cacheAccess(ICACHE, PC_cpy, &instruction, READ, WORD_SIZE);
-      if (!hit) {
-        iCache_stalls = (iCache_stalls <= iCache.missLatency) ? iCache.missLatency: iCache_stalls;
+  // Books a non-blocking dCache access into the MSHRs. Returns the cycle its
+  // data is available, and stalls the pipeline only if a new miss finds every
+  // MSHR busy.
+  uint32_t trackMiss(uint32_t memAddress, bool hit, uint32_t penalty)
+  {
+    uint32_t now = cyclesElapsed;
+    uint32_t block = memAddress & ~(dCache.blockBytes() - 1);
+    // A block that is already on its way merges into its MSHR
+    for (uint32_t m = 0; m < mshrs.size(); m++) {
+      if (mshrs[m].block == block && mshrs[m].readyCycle > now) {
+        mshrMerged++;
+        return mshrs[m].readyCycle;
       }
-      if_instruction = instruction;
-      PC_cpy = PC;
-      if_id.nPC = PC + 4;
-      if_id.IR = instruction;
     }
-    else {
-      if_instruction = 0;
-      wb_instruction = 0;
+    if (hit) {
+      return now + penalty;
     }
 
-    if (instruction == 0xfeedfeed) {
-      if (!hit_exception){
-        feedfeed_hit = true;
+    uint32_t m = 0;
+    for (uint32_t k = 1; k < mshrs.size(); k++) {
+      if (mshrs[k].readyCycle < mshrs[m].readyCycle) {
+        m = k;
       }
     }
-}
+    uint32_t start = now;
+    if (mshrs[m].readyCycle > now) {
+      start = mshrs[m].readyCycle;
+      dCache_stalls = (dCache_stalls <= (int)(start - now)) ? start - now : dCache_stalls;
+      mshrFullStalls += start - now;
+    }
+    mshrs[m].block = block;
+    mshrs[m].readyCycle = start + penalty;
+    mshrPrimary++;
 
-// HANDLE THE ID SECTION
-static void idSection() {
-    // If we are stalling, do nothing
-    if (load_use_stalls > 1) {
-      return;
+    missCycles += penalty;
+    if (start >= missBusyUntil) {
+      missBusyCycles += penalty;
+    } else if (start + penalty > missBusyUntil) {
+      missBusyCycles += start + penalty - missBusyUntil;
+    }
+    if (start + penalty > missBusyUntil) {
+      missBusyUntil = start + penalty;
     }
+    return start + penalty;
+  }
 
-    // Decode the instruction from IF
-    uint32_t instruction = if_id_cpy.IR;
-    load_use_stall = false;
-    id_ex.opcode = instruction >> 26;
-    id_ex.RS = instruction << 6 >> 27;
-    id_ex.RT = instruction << 11 >> 27;
-    id_ex.RD = instruction << 16 >> 27;
-    id_ex.func_code = instruction & (63);
-    id_ex.immed = instruction << 16 >> 16;
-    id_ex.A = reg[id_ex.RS];
-    id_ex.B = reg[id_ex.RT];
-    id_ex.shamt = instruction << 21 >> 27;
-    id_ex.seimmed = (id_ex.immed >> 15 == 0) ? (uint32_t)id_ex.immed : ((uint32_t)id_ex.immed | 0xffff0000);
-    id_ex.IR = instruction;
-    id_ex.insertedNOP = false;
-    bool memRead = isMemRead(id_ex.opcode);
-
-    // Handle illegal instruction exception
-    if ((!isValidInstruction(id_ex.opcode, id_ex.func_code)) && (instruction != 0xfeedfeed)) {
-      handleException(false);
-    }
-
-    // Determines if instruction is a branch, used for branch handling/forwarding
-    bool isBranch = false;
-    if (((id_ex.opcode >= 0x2) && (id_ex.opcode <= 0x7)) || ((id_ex.opcode == 0) && (id_ex.func_code == 0x8))) {
-      isBranch = true;
-    }
-
-    // Handles load-use stalls
-    if ((!isBranch) && ex_mem.memRead && (ex_mem.RD != 0) &&((ex_mem.RD == id_ex.RS) || (ex_mem.RD == id_ex.RT))) {
-      instruction = 0;
-      id_ex = IDEX();
-      id_ex.insertedNOP = true;
-      id_ex.regWrite = false;
-
-      load_use_stall = true;
-      load_use_stalls = 1;
-      return;
+  // Cycles an instruction in ID must wait for registers still being loaded by
+  // outstanding misses (sources, and the destination to keep writes in order)
+  uint32_t scoreboardWait(uint32_t opcode, uint32_t rs, uint32_t rt, uint32_t rd)
+  {
+    uint32_t ready = max(regReady[rs], regReady[rt]);
+    if (opcode == 0) {
+      ready = max(ready, regReady[rd]);
     }
+    return (ready > cyclesElapsed) ? ready - cyclesElapsed : 0;
+  }
+
+  /* END OF CACHE SECTION */
 
-    if (!isBranch) {
-      advance_pc(4);
+  /* START OF PIPELINE SECTION */
+
+  // Returns the decode of instruction, fetched from pc, decoding it into the
+  // cache if the entry for pc holds anything else
+  const MicroOp & decode(uint32_t pc, uint32_t instruction) {
+    MicroOp & entry = decoded[(pc >> 2) & (DECODE_CACHE_ENTRIES - 1)];
+    if (entry.PC != pc || entry.IR != instruction) {
+      entry = decodeInstr(pc, instruction);
     }
+    return entry;
+  }
+
+  // advance PC function
+  void advance_pc(uint32_t offset)
+  {
+    PC  += offset;
+  }
 
-    // ID forwarding for branches
-    bool clear_flag = false;
-    if (isBranch) {
+  // Handles exceptions when they arise
+  void handleException(bool isArithmetic) {
+    hit_exception = true;
+
+    // Squash the instruction going into EX stage
+    next->id_ex.opcode = 0;
+    next->id_ex.func_code = 0;
+    next->id_ex.nPC = 0;
+    next->id_ex.RS = 0;
+    next->id_ex.RT = 0;
+    next->id_ex.RD = 0;
+    next->id_ex.immed = 0;
+    next->id_ex.A = 0;
+    next->id_ex.B = 0;
+    next->id_ex.seimmed = 0;
+    next->id_ex.operand = bubble.operand;
+    next->id_ex.control = bubble.control;
+    next->id_ex.execute = bubble.execute;
+
+    if (isArithmetic) {
+       // Squash instruction going into MEM stage if arithmetic exception
+      next->ex_mem.BrTgt = 0;
+      next->ex_mem.Zero = 0;
+      next->ex_mem.ALUOut = 0;
+      next->ex_mem.RD = 0;
+      next->ex_mem.B = 0;
+      next->ex_mem.regWrite = 0;
+      next->ex_mem.memWrite = 0;
+      next->ex_mem.memRead = 0;
+      next->ex_mem.IR = 0;
+      next->ex_mem.nPC = 0;
+      next->ex_mem.PC = 0;
+    }
+    PC = 0x8000;
+    nPC = PC + WORD_SIZE;
+  }
+
+
+  // HANDLE THE IF SECTION
+  void ifSection() {
+      uint32_t instruction = 0;
+
+      // ID is waiting on an outstanding load, so hold the fetched instruction
+      if (scoreboard_stall) {
+        scoreboard_stall = false;
+        next->if_id = prev->if_id;
+        return;
+      }
 
-      // MEM Forwarding to ID (| --- | branch | --- | --- | load |)
-      if ((mem_wb_cpy.regWrite && (mem_wb_cpy.RD != 0)) && (mem_wb_cpy.RD == id_ex.RS)) {
-        id_ex.A = mem_wb_cpy.ALUOut;
+      // Now we are no longer fetching instructions until the load-use stall is over
+      if (load_use_stall_delay) {
+        load_use_stalls = load_use_stalls - 1;
+        if (load_use_stalls == 0) {
+          load_use_stall_delay = false;
+          next->if_id.IR = if_instruction;
+          next->if_id.PC = PC_cpy;
+          next->if_id.nPC = prev->if_id.nPC;
+          next->if_id.fetched = true;
+          PC_cpy = PC;
+        }
+        else {
+          next->if_id = prev->if_id;
+        }
+        return;
       }
-      if ((mem_wb_cpy.regWrite && (mem_wb_cpy.RD != 0)) && (mem_wb_cpy.RD == id_ex.RT)) {
-        id_ex.B = mem_wb_cpy.ALUOut;
+
+      // We just hit a load use stall later in the pipeline, so we still need to fetch an insruction
+      if (load_use_stall) {
+        load_use_stall_delay = true;
+        load_use_stall = false;
+
+        // Misses, and hits on prefetched lines still in flight, stall
+        cacheAccess<ICACHE, READ, WORD_SIZE>(PC_cpy, &instruction, PC_cpy);
+        iCache_stalls = (iCache_stalls <= iCache.penalty) ? iCache.penalty: iCache_stalls;
+        if_instruction = instruction;
+        next->if_id = prev->if_id;
+        return;
       }
 
-      // EX Forwarding to ID (| --- | branch | --- | ALU | --- |)
-      if ((ex_mem_cpy.regWrite && (ex_mem_cpy.RD != 0)) && (ex_mem_cpy.RD == id_ex.RS)) {
-        id_ex.A = ex_mem_cpy.ALUOut;
+      next->if_id.IR = 0;
+      next->if_id.fetched = false;
+      next->if_id.PC = prev->if_id.PC;
+      next->if_id.nPC = prev->if_id.nPC;
+
+      // If we haven't hit 0xfeedfeed, then fetch an insruction
+      if (!feedfeed_hit) {
+        cacheAccess<ICACHE, READ, WORD_SIZE>(PC_cpy, &instruction, PC_cpy);
+        iCache_stalls = (iCache_stalls <= iCache.penalty) ? iCache.penalty: iCache_stalls;
+        if_instruction = instruction;
+        next->if_id.PC = PC_cpy;
+        PC_cpy = PC;
+        next->if_id.nPC = PC + 4;
+        next->if_id.IR = instruction;
+        next->if_id.fetched = true;
       }
-      if ((ex_mem_cpy.regWrite && (ex_mem_cpy.RD != 0)) && (ex_mem_cpy.RD == id_ex.RT)) {
-        id_ex.B = ex_mem_cpy.ALUOut;
+      else {
+        if_instruction = 0;
+        wb_instruction = 0;
       }
 
-      // MEM Stall by 1 cycle (| --- | branch | --- | load | --- |)
-      if ((ex_mem_cpy.memRead && (ex_mem_cpy.RD != 0)) && (ex_mem_cpy.RD == id_ex.RS)) {
-        instruction = 0;
-        clear_flag = true;
-        load_use_stall = true;
-        load_use_stalls = 1;
+      if (instruction == 0xfeedfeed) {
+        if (!hit_exception){
+          feedfeed_hit = true;
+        }
       }
-      if ((ex_mem_cpy.memRead && (ex_mem_cpy.RD != 0)) && (ex_mem_cpy.RD == id_ex.RT)) {
-        instruction = 0;
-        clear_flag = true;
-        load_use_stall = true;
-        load_use_stalls = 1;
+  }
+
+  // HANDLE THE ID SECTION
+  void idSection() {
+      // If we are stalling, hold what is going into EX
+      if (load_use_stalls > 1) {
+        next->id_ex = prev->id_ex;
+        return;
       }
 
-      // EX Stall by 1 cycle (| --- | branch | ALU | --- | --- |)
-      if (ex_mem.regWrite && ((ex_mem.RD != 0) && (ex_mem.RD == id_ex.RS))) {
-        instruction = 0;
-        clear_flag = true;
-        load_use_stall = true;
-        load_use_stalls = 1;
+      // Decode the instruction from IF, or reuse its decode from the last
+      // time it was fetched from this address
+      uint32_t instruction = prev->if_id.IR;
+      const MicroOp & op = decode(prev->if_id.PC, instruction);
+      load_use_stall = false;
+      next->id_ex.opcode = op.opcode;
+      next->id_ex.RS = op.RS;
+      next->id_ex.RT = op.RT;
+      next->id_ex.RD = op.RD;
+      next->id_ex.func_code = op.func_code;
+      next->id_ex.immed = op.immed;
+      next->id_ex.A = reg[op.RS];
+      next->id_ex.B = reg[op.RT];
+      next->id_ex.shamt = op.shamt;
+      next->id_ex.seimmed = op.seimmed;
+      next->id_ex.IR = instruction;
+      next->id_ex.PC = prev->if_id.PC;
+      next->id_ex.insertedNOP = false;
+      next->id_ex.memRead = (op.control & UOP_MEM_READ) != 0;
+      next->id_ex.regWrite = (op.control & UOP_REG_WRITE) != 0;
+      next->id_ex.operand = op.operand;
+      next->id_ex.control = op.control;
+      next->id_ex.execute = op.execute;
+
+      // Waits on loads still outstanding in the non-blocking dCache. IF and ID
+      // hold for the cycle and the instruction is decoded again next cycle.
+      if (!mshrs.empty() && scoreboardWait(next->id_ex.opcode, next->id_ex.RS, next->id_ex.RT, next->id_ex.RD) > 0) {
+        next->id_ex = bubble;
+        next->id_ex.insertedNOP = true;
+        next->id_ex.regWrite = false;
+
+        scoreboard_stall = true;
+        scoreboardStalls++;
+        return;
+      }
+
+      // Handle illegal instruction exception
+      if (!(op.control & UOP_VALID) && (instruction != 0xfeedfeed)) {
+        handleException(false);
       }
-      if (ex_mem.regWrite && ((ex_mem.RD != 0) && (ex_mem.RD == id_ex.RT))) {
+
+      // Determines if instruction is a branch, used for branch handling/forwarding
+      bool isBranch = (op.control & UOP_BRANCH) != 0;
+
+      // Handles load-use stalls
+      if ((!isBranch) && next->ex_mem.memRead && (next->ex_mem.RD != 0) &&((next->ex_mem.RD == next->id_ex.RS) || (next->ex_mem.RD == next->id_ex.RT))) {
         instruction = 0;
-        clear_flag = true;
+        next->id_ex = bubble;
+        next->id_ex.insertedNOP = true;
+        next->id_ex.regWrite = false;
+
         load_use_stall = true;
         load_use_stalls = 1;
+        return;
       }
 
-      // MEM Stall by 2 cycles (| --- | branch | load | --- | --- |)
-      if (ex_mem.memRead && ((ex_mem.RD != 0) && (ex_mem.RD == id_ex.RS))) {
-        instruction = 0;
-        clear_flag = true;
-        load_use_stall = true;
-        load_use_stalls = 2;
+      if (!isBranch) {
+        advance_pc(4);
       }
-      if (ex_mem.memRead && ((ex_mem.RD != 0) && (ex_mem.RD == id_ex.RT))) {
-        instruction = 0;
-        clear_flag = true;
-        load_use_stall = true;
-        load_use_stalls = 2;
-      }
-    }
-    if (clear_flag) {
-       id_ex = IDEX();
-    }
 
-    uint32_t mostSig_ex = id_ex.immed >> 15; // most significant bit in immediate
-    uint32_t imm_ex = 0;
-    uint32_t target = (instruction << 6) >> 6;
+      // ID forwarding for branches
+      bool clear_flag = false;
+      if (isBranch) {
 
-    // Branch handling
-    switch (id_ex.opcode) {
-      // beq
-      case (0x4):
-        if (id_ex.A == id_ex.B) {
-            advance_pc(id_ex.seimmed << 2);
+        // MEM Forwarding to ID (| --- | branch | --- | --- | load |)
+        if ((prev->mem_wb.regWrite && (prev->mem_wb.RD != 0)) && (prev->mem_wb.RD == next->id_ex.RS)) {
+          next->id_ex.A = prev->mem_wb.ALUOut;
         }
-        else {
-          advance_pc(4);
+        if ((prev->mem_wb.regWrite && (prev->mem_wb.RD != 0)) && (prev->mem_wb.RD == next->id_ex.RT)) {
+          next->id_ex.B = prev->mem_wb.ALUOut;
         }
-        break;
-      // bne
-      case (0x5):
-        if (id_ex.A != id_ex.B) {
-            advance_pc(id_ex.seimmed << 2);
+
+        // EX Forwarding to ID (| --- | branch | --- | ALU | --- |)
+        if ((prev->ex_mem.regWrite && (prev->ex_mem.RD != 0)) && (prev->ex_mem.RD == next->id_ex.RS)) {
+          next->id_ex.A = prev->ex_mem.ALUOut;
         }
-        else {
-          advance_pc(4);
+        if ((prev->ex_mem.regWrite && (prev->ex_mem.RD != 0)) && (prev->ex_mem.RD == next->id_ex.RT)) {
+          next->id_ex.B = prev->ex_mem.ALUOut;
         }
-        break;
-      // j
-      case (0x2):
-        PC = (PC & 0xf0000000) | (target << 2);
-        break;
-      // jal
-      case (0x3):
-        id_ex.RD = 31;
-        id_ex.A = PC + 4;
-        PC = (PC & 0xf0000000) | (target << 2);
-        break;
-      // blez
-      case (0x6):
-         if (static_cast<int32_t>(id_ex.A) <= 0) {
-            advance_pc(id_ex.seimmed << 2);
+
+        // MEM Stall by 1 cycle (| --- | branch | --- | load | --- |)
+        if ((prev->ex_mem.memRead && (prev->ex_mem.RD != 0)) && (prev->ex_mem.RD == next->id_ex.RS)) {
+          instruction = 0;
+          clear_flag = true;
+          load_use_stall = true;
+          load_use_stalls = 1;
         }
-        else {
-          advance_pc(4);
+        if ((prev->ex_mem.memRead && (prev->ex_mem.RD != 0)) && (prev->ex_mem.RD == next->id_ex.RT)) {
+          instruction = 0;
+          clear_flag = true;
+          load_use_stall = true;
+          load_use_stalls = 1;
         }
-        break;
-      // bgtz
-      case (0x7):
-         if (static_cast<int32_t>(id_ex.A) > 0) {
-            advance_pc(id_ex.seimmed << 2);
+
+        // EX Stall by 1 cycle (| --- | branch | ALU | --- | --- |)
+        if (next->ex_mem.regWrite && ((next->ex_mem.RD != 0) && (next->ex_mem.RD == next->id_ex.RS))) {
+          instruction = 0;
+          clear_flag = true;
+          load_use_stall = true;
+          load_use_stalls = 1;
         }
-        else {
-          advance_pc(4);
+        if (next->ex_mem.regWrite && ((next->ex_mem.RD != 0) && (next->ex_mem.RD == next->id_ex.RT))) {
+          instruction = 0;
+          clear_flag = true;
+          load_use_stall = true;
+          load_use_stalls = 1;
         }
-        break;
-      // jr
-      case (0x0):
-        if (id_ex.func_code == 0x8) {
-          PC = id_ex.A;
+
+        // MEM Stall by 2 cycles (| --- | branch | load | --- | --- |)
+        if (next->ex_mem.memRead && ((next->ex_mem.RD != 0) && (next->ex_mem.RD == next->id_ex.RS))) {
+          instruction = 0;
+          clear_flag = true;
+          load_use_stall = true;
+          load_use_stalls = 2;
         }
-        break;
-      default:
-        break;
-    }
+        if (next->ex_mem.memRead && ((next->ex_mem.RD != 0) && (next->ex_mem.RD == next->id_ex.RT))) {
+          instruction = 0;
+          clear_flag = true;
+          load_use_stall = true;
+          load_use_stalls = 2;
+        }
+      }
+      if (clear_flag) {
+         next->id_ex = bubble;
+      }
 
-    // Squash ID stage if illegal instruction exception occurs
-    if (hit_exception) {
-       id_ex = IDEX();
-    }
-    id_ex.nPC = if_id_cpy.nPC + 4;
-}
+      uint32_t mostSig_ex = next->id_ex.immed >> 15; // most significant bit in immediate
+      uint32_t imm_ex = 0;
+      uint32_t target = (instruction << 6) >> 6;
 
-// HANDLE THE EX SECTION
-static void exSection() {
-    // Get the data from ID
-    int opCode = id_ex_cpy.opcode;
-    uint32_t rs = id_ex_cpy.RS; // operand
-    uint32_t rt = id_ex_cpy.RT; // destination operand for imm instructions
-    uint32_t rd = id_ex_cpy.RD; // destination operand
-    uint32_t imm = id_ex_cpy.immed; // immediate address
-    uint32_t mostSig = imm >> 15; // most significant bit in immediate
-    uint32_t func_code = id_ex_cpy.func_code;
-    uint32_t A = id_ex_cpy.A;
-    uint32_t B = id_ex_cpy.B;
-    uint32_t shamt = id_ex_cpy.shamt;
-
-    // Intialize some EXMEM register variables
-    ex_mem.B = id_ex_cpy.B;
-    ex_mem.IR = id_ex_cpy.IR;
-
-    // More instruction specific details/fixing
-    bool regWrite = isRegWrite(opCode, func_code);
-    if (id_ex_cpy.IR == 0xfeedfeed){
-      regWrite = false;
-    }
-    bool memWrite = isMemWrite(opCode);
-    bool memRead = isMemRead(opCode);
-
-    if (opCode == 0) {
-      ex_mem.RD = rd;
-    }
-    else if (opCode == 0x3) {
-      ex_mem.RD = rd;
-      ex_mem.ALUOut = id_ex_cpy.A;
-    }
-    else {
-      ex_mem.RD = rt;
-    }
+      // Branch handling
+      switch (next->id_ex.opcode) {
+        // beq
+        case (0x4):
+          if (next->id_ex.A == next->id_ex.B) {
+              advance_pc(next->id_ex.seimmed << 2);
+          }
+          else {
+            advance_pc(4);
+          }
+          break;
+        // bne
+        case (0x5):
+          if (next->id_ex.A != next->id_ex.B) {
+              advance_pc(next->id_ex.seimmed << 2);
+          }
+          else {
+            advance_pc(4);
+          }
+          break;
+        // j
+        case (0x2):
+          PC = (PC & 0xf0000000) | (target << 2);
+          break;
+        // jal
+        case (0x3):
+          next->id_ex.RD = 31;
+          next->id_ex.A = PC + 4;
+          PC = (PC & 0xf0000000) | (target << 2);
+          break;
+        // blez
+        case (0x6):
+           if (static_cast<int32_t>(next->id_ex.A) <= 0) {
+              advance_pc(next->id_ex.seimmed << 2);
+          }
+          else {
+            advance_pc(4);
+          }
+          break;
+        // bgtz
+        case (0x7):
+           if (static_cast<int32_t>(next->id_ex.A) > 0) {
+              advance_pc(next->id_ex.seimmed << 2);
+          }
+          else {
+            advance_pc(4);
+          }
+          break;
+        // jr
+        case (0x0):
+          if (next->id_ex.func_code == 0x8) {
+            PC = next->id_ex.A;
+          }
+          break;
+        default:
+          break;
+      }
 
-    // Forwarding to EX
-    if (ex_fwd_A == 1) {
-      A = mem_wb_cpy.ALUOut;
-    }
-    if (ex_fwd_A == 2) {
-      A = ex_mem_cpy.ALUOut;
-    }
-    if (ex_fwd_B == 1) {
-      B = mem_wb_cpy.ALUOut;
-    }
-    if (ex_fwd_B == 2) {
-     B = ex_mem_cpy.ALUOut;
-    }
+      // Squash ID stage if illegal instruction exception occurs
+      if (hit_exception) {
+         next->id_ex = bubble;
+      }
+      next->id_ex.nPC = prev->if_id.nPC + 4;
 
-    switch (opCode) {
-      // R-type instructions
-      case 0:
-      {
-        // nested switch statements based on function code
-        // for r-type instructions.
-        switch (func_code)
-        {
-          // add
-          case 0x20:
-          {
-            // Need to handle overflow exceptions
-            uint32_t sigbit_rs = A >> 31;
-            uint32_t sigbit_rt = B >> 31;
-            uint32_t res = (uint32_t)((int)A + (int)B);
-            uint32_t sigbit_rd = res >> 31;
-            if (sigbit_rs == sigbit_rt) {
-                if (sigbit_rd != sigbit_rs) {
-                    handleException(true);
-                    return;
-                }
-            }
-            ex_mem.ALUOut = res;
-            break;
-           }
-          // addu
-          case 0x21:
-            ex_mem.ALUOut = A + B;
-            break;
-          // and
-          case 0x24:
-            ex_mem.ALUOut = A & B;
-            break;
-          // nor
-          case 0x27:
-            ex_mem.ALUOut = ~(A | B);
-            break;
-          // or
-          case 0x25:
-            ex_mem.ALUOut = A | B;
-            break;
-          // slt (signed)
-          case 0x2a:
-            ex_mem.ALUOut = ((int)A < (int)B) ? 1 : 0;
-            break;
-          // sltu
-          case 0x2b:
-            ex_mem.ALUOut = (A < B) ? 1 : 0;
-            break;
-          // sll
-          case 0x00:
-            ex_mem.ALUOut = (B << shamt);
-            break;
-          // srl
-          case 0x02:
-            ex_mem.ALUOut = (B >> shamt);
-            break;
-          // sub (signed)
-          case 0x22:
+      // A fetched instruction has left ID for good
+      if (prev->if_id.fetched && !clear_flag && !hit_exception) {
+        instructionsIssued++;
+      }
+  }
+
+  // HANDLE THE EX SECTION
+  void exSection() {
+      // Get the data from ID
+      int opCode = prev->id_ex.opcode;
+      uint32_t rt = prev->id_ex.RT; // destination operand for imm instructions
+      uint32_t rd = prev->id_ex.RD; // destination operand
+      uint32_t A = prev->id_ex.A;
+      uint32_t B = prev->id_ex.B;
+
+      // Intialize some EXMEM register variables
+      next->ex_mem.B = prev->id_ex.B;
+      next->ex_mem.IR = prev->id_ex.IR;
+      next->ex_mem.nPC = prev->id_ex.nPC;
+      next->ex_mem.PC = prev->id_ex.PC;
+      next->ex_mem.BrTgt = 0;
+      next->ex_mem.Zero = 0;
+      // Instructions without an ALU result pass the last one on
+      next->ex_mem.ALUOut = prev->ex_mem.ALUOut;
+
+      // More instruction specific details/fixing
+      bool regWrite = (prev->id_ex.control & UOP_REG_WRITE) != 0;
+      if (prev->id_ex.IR == 0xfeedfeed){
+        regWrite = false;
+      }
+      bool memWrite = (prev->id_ex.control & UOP_MEM_WRITE) != 0;
+      bool memRead = (prev->id_ex.control & UOP_MEM_READ) != 0;
+
+      if (opCode == 0) {
+        next->ex_mem.RD = rd;
+      }
+      else if (opCode == 0x3) {
+        next->ex_mem.RD = rd;
+        next->ex_mem.ALUOut = prev->id_ex.A;
+      }
+      else {
+        next->ex_mem.RD = rt;
+      }
+
+      // Forwarding to EX
+      if (ex_fwd_A == 1) {
+        A = prev->mem_wb.ALUOut;
+      }
+      if (ex_fwd_A == 2) {
+        A = prev->ex_mem.ALUOut;
+      }
+      if (ex_fwd_B == 1) {
+        B = prev->mem_wb.ALUOut;
+      }
+      if (ex_fwd_B == 2) {
+       B = prev->ex_mem.ALUOut;
+      }
+
+      // The handler picked at decode does the ALU work
+      if (!prev->id_ex.execute(A, B, prev->id_ex.operand, next->ex_mem)) {
+        handleException(true);
+        return;
+      }
+
+    // Update pipeline registers
+    next->ex_mem.memRead = memRead;
+    next->ex_mem.memWrite = memWrite;
+    next->ex_mem.regWrite = regWrite;
+  }
+
+  // START OF MEM SECTION
+  void memSection() {
+    // Getting data about instruction
+    next->mem_wb.RD = prev->ex_mem.RD;
+    next->mem_wb.ALUOut = prev->ex_mem.ALUOut;
+    next->mem_wb.regWrite = prev->ex_mem.regWrite;
+    next->mem_wb.IR = prev->ex_mem.IR;
+    next->mem_wb.memData = 0;
+
+    uint32_t storeData = 0;
+    uint32_t opcode = 0;
+    uint32_t func_code = 0;
+    bool memRead_mem = prev->ex_mem.memRead;
+    bool memWrite_mem = prev->ex_mem.memWrite;
+    bool regWrite = prev->ex_mem.regWrite;
+
+    // Get the size to write to
+    uint32_t size = WORD_SIZE;
+    if (memRead_mem || memWrite_mem) {
+      opcode = next->mem_wb.IR >> 26;
+      func_code = next->mem_wb.IR  & (63);
+      switch (opcode) {
+        case 0x28:
+  	{
+  	  size = BYTE_SIZE;
+  	  // store byte
+  	  break;
+  	}
+        case 0x29:
+  	{
+  	  size = HALF_SIZE;
+  	  // store halfword
+  	  break;
+  	}
+        case 0x2b:
+  	{
+  	  size = WORD_SIZE;
+  	  // store word
+  	  break;
+  	}
+
+        case 0x24:
+  	{
+  	  // load byte unsigned
+  	  size = BYTE_SIZE;
+  	  break;
+  	}
+        case 0x25:
+  	{
+  	  size = HALF_SIZE;
+  	  break;
+  	}
+        case 0x23:
           {
-            // Need to handle overflow exceptions
-            uint32_t sigbit_rs = A >> 31;
-            uint32_t sigbit_rt = B >> 31;
-            uint32_t res = (uint32_t)((int)A - (int)B);
-            uint32_t sigbit_rd = res >> 31;
-            if ((sigbit_rs == 0) && (sigbit_rt == 1)) {
-                if (sigbit_rd == 1) {
-                    handleException(true);
-                    return;
-                }
-            }
-            else if ((sigbit_rs == 1) && (sigbit_rt == 0)) {
-                if (sigbit_rd == 0) {
-                    handleException(true);
-                    return;
-                }
-            }
-            ex_mem.ALUOut = res;
+            size = WORD_SIZE;
+            // load word
             break;
           }
-          // subu
-          case 0x23:
-            ex_mem.ALUOut = A - B;
-            break;
-        }
-    break;
-    }
-    // I-type instructions
-    case 0x8:
-    {
-      // add-immediate
-      // sign extend in c++, get the most significant bit
-      if (mostSig == 1) {
-          imm = imm | 0xffff0000;
-      }
-      // More exception handling
-      uint32_t sigbit_rs = A >> 31;
-      uint32_t sigbit_imm = imm >> 31;
-      uint32_t res = (uint32_t)((int)A + (int)imm);
-      uint32_t sigbit_rd = res >> 31;
-      if (sigbit_rs == sigbit_imm) {
-          if (sigbit_rd != sigbit_rs) {
-              handleException(true);
-              return;
-          }
+        default:
+           break;
+
       }
-      ex_mem.ALUOut = res;
-      break;
+
     }
-    case 0x9:
-    {
-      // add-immediate unsigned
-      // sign extend in c++, get the most significant bit
-      if (mostSig == 1) {
-          imm = imm | 0xffff0000;
+
+    // Read from memory
+    if (memRead_mem) {
+      // Misses, and hits on prefetched lines still in flight, stall
+      bool hit = dCacheAccess(prev->ex_mem.ALUOut, &storeData, READ, size, prev->ex_mem.PC);
+      if (mshrs.empty()) {
+        dCache_stalls = (dCache_stalls <= dCache.penalty) ? dCache.penalty: dCache_stalls;
+      } else if (prev->ex_mem.RD != 0) {
+        // Non-blocking: only instructions that need the value wait for it
+        regReady[prev->ex_mem.RD] = trackMiss(prev->ex_mem.ALUOut, hit, dCache.penalty);
+      } else {
+        trackMiss(prev->ex_mem.ALUOut, hit, dCache.penalty);
+      }
+      next->mem_wb.ALUOut = storeData;
+    }
+    // Write to memory
+    if (memWrite_mem) {
+      bool hit = dCacheAccess(prev->ex_mem.ALUOut, &prev->ex_mem.B, WRITE, size, prev->ex_mem.PC);
+      // Store misses retire into the write buffer rather than an MSHR, and only
+      // stall while it is full
+      if (mshrs.empty() || dCache.writeBufferEntries) {
+        dCache_stalls = (dCache_stalls <= dCache.penalty) ? dCache.penalty: dCache_stalls;
+      } else {
+        trackMiss(prev->ex_mem.ALUOut, hit, dCache.penalty);
       }
-      ex_mem.ALUOut = A + imm;
-      break;
     }
-    case 0xc:
-    {
-      // and immediate
-      ex_mem.ALUOut = A & imm;
-      break;
+  }
+
+  // START OF WB SECTION (returns if halt has reached wb)
+  bool wbSection() {
+    // hardwire zero to ground
+    reg[0] = 0;
+    wb_instruction = prev->mem_wb.IR;
+
+    // If feedfeed is in wb, send halt through
+    if (prev->mem_wb.IR == 0xfeedfeed) {
+      return true;
     }
-    case 0xd:
-    {
-      // or immediate
-      ex_mem.ALUOut = A | imm;
-      break;
+
+    // Writes to register file
+    if (isRegWrite(wb_instruction >> 26, wb_instruction & (63))) {
+      reg[prev->mem_wb.RD] = prev->mem_wb.ALUOut;
     }
-    case 0xa:
-    {
-      // set less than immediate
-      if (mostSig == 1) {
-          imm = imm | 0xffff0000;
+
+    // No 0xfeedfeed reached
+    return false;
+  }
+
+  // Helper function that runs only one cycle
+  bool runOneCycle() {
+      // Corner case for calling runCycles(0);
+      started = true;
+
+      // If we are in a cache stall, update
+      if ((iCache_stalls > 0) || (dCache_stalls > 0)) {
+        iCache_stalls--;
+        dCache_stalls--;
+        if (iCache_stalls < 0) {
+          iCache_stalls = 0;
+        }
+        if (dCache_stalls < 0) {
+          dCache_stalls = 0;
+        }
+
+        return false;
       }
-      ex_mem.ALUOut = ((int)A < (int)imm) ? 1 : 0;
-      break;
-    }
-    case 0xb:
-    {
-      // set less than immediate unsigned
-      if (mostSig == 1) {
-         imm = imm | 0xffff0000;
+      // Once out of cache stall, keep the caches' new values
+      iCache.commit();
+      dCache.commit();
+      if (l2Enabled) {
+         l2Cache.commit();
       }
-      ex_mem.ALUOut = (A < imm) ? 1 : 0;
-      break;
-    }
-    case 0x24:
-    {
-      // load byte unsigned
-      if (mostSig == 1) {
-          imm = imm | 0xfffc0000;
+
+      // Forwarding Section
+      ex_fwd_A = 0;
+      ex_fwd_B = 0;
+      // EX Hazard (forward to EX)
+      if (prev->ex_mem.regWrite && ((prev->ex_mem.RD != 0) && (prev->ex_mem.RD == prev->id_ex.RS))) {
+        ex_fwd_A = 2;
       }
-      uint32_t res = imm + A;
-      ex_mem.ALUOut = res;
-      break;
-    }
-    case 0x25:
-    {
-      // load half word unsigned
-      if (mostSig == 1) {
-          imm = imm | 0xfffc0000;
+      if (prev->ex_mem.regWrite && ((prev->ex_mem.RD != 0) && (prev->ex_mem.RD == prev->id_ex.RT))) {
+        ex_fwd_B = 2;
       }
-      uint32_t res = imm + A;
-      ex_mem.ALUOut = res;
-      break;
+      // MEM Hazard (forward to EX)
+      if ((prev->mem_wb.regWrite && (prev->mem_wb.RD != 0)) && !(prev->ex_mem.regWrite && ((prev->ex_mem.RD != 0) && (prev->ex_mem.RD == prev->id_ex.RS))) && (prev->mem_wb.RD == prev->id_ex.RS)) {
+        ex_fwd_A = 1;
+      }
+      if ((prev->mem_wb.regWrite && (prev->mem_wb.RD != 0)) && !(prev->ex_mem.regWrite && ((prev->ex_mem.RD != 0) && (prev->ex_mem.RD == prev->id_ex.RT))) && (prev->mem_wb.RD == prev->id_ex.RT)) {
+        ex_fwd_B = 1;
+      }
+
+      // If we've hit an exception, squash the ID stage
+      if (hit_exception) {
+         prev->if_id.IR = 0;
+         prev->if_id.nPC = 0;
+         prev->if_id.fetched = false;
+      }
+
+      // Run all sections backwards
+      bool halt = wbSection();
+      memSection();
+      exSection();
+      idSection();
+      ifSection();
+
+      return halt;
+  }
+
+
+  // Makes this cycle's pipeline registers the ones the next cycle reads,
+  // unless a cache stall is holding the pipeline. Every stage writes the
+  // whole of its register each cycle, so no copy is needed.
+  void latch() {
+    if ((iCache_stalls <= 0) && (dCache_stalls <= 0)) {
+      swap(prev, next);
     }
-    case 0xf:
-    {
-      // load upper immediate
-      ex_mem.ALUOut = (imm << 16);
-      break;
+  }
+
+  // Remembers the instruction in each stage for dumpPipeState. IF shows as
+  // UNKNOWN during an iCache stall unless showFetch is set.
+  void capturePipeState(bool showFetch) {
+    mostRecentPS.cycle = cyclesElapsed;
+    // If iCache stalled, need to pass 0xdeefdeef (UNKNOWN) into pipe state
+    if (iCache_stalls > 0 && !showFetch) {
+      mostRecentPS.ifInstr = 0xdeefdeef;
     }
-    case 0x23:
-    {
-      // load word
-      uint32_t res = 0;
-      if (mostSig == 1) {
-          imm = imm | 0xffff0000;
-      }
-      res = imm + A;
-      ex_mem.ALUOut = res;
-      break;
+    else {
+      mostRecentPS.ifInstr = if_instruction;
     }
-    case 0x28:
-    {
-      // store byte
-      if (mostSig == 1) {
-          imm = imm | 0xffff0000;
-      }
-      uint32_t location = 0;
-      location = A + imm;
-      ex_mem.ALUOut = location;
-      ex_mem.B = B & (0x000000ff);
-      break;
+    mostRecentPS.idInstr = prev->if_id.IR;
+    mostRecentPS.exInstr = prev->id_ex.IR;
+    mostRecentPS.memInstr = prev->ex_mem.IR;
+    mostRecentPS.wbInstr = prev->mem_wb.IR;
+  }
+
+  // Skips up to maxCycles cycles of a cache stall in one go. Those cycles
+  // only count the stall down, so the result is the same as running them
+  // one by one, including the latch on the cycle the stall ends.
+  void skipStall(uint32_t maxCycles) {
+    int stall = max(iCache_stalls, dCache_stalls);
+    if (stall <= 0 || maxCycles == 0) {
+      return;
     }
-    case 0x29:
-    {
-      // store halfword
-      if (mostSig == 1) {
-          imm = imm | 0xffff0000;
-      }
-      uint32_t location = 0;
-      location = A + imm;
-      ex_mem.B = B & (0x0000ffff);
-      ex_mem.ALUOut = location;
-      break;
+    uint32_t skipped = min((uint32_t)stall, maxCycles);
+    started = true;
+    iCache_stalls = max(iCache_stalls - (int)skipped, 0);
+    dCache_stalls = max(dCache_stalls - (int)skipped, 0);
+    latch();
+    cyclesElapsed = cyclesElapsed + skipped;
+  }
+
+  // Runs one cycle, capturing the pipe state if snapshot is set or the cycle
+  // reaches the halt. Returns true on the halt, leaving the pipeline as that
+  // cycle saw it; otherwise latches the results and moves to the next cycle.
+  // runTillHalt's dump shows the fetched instruction even when the halt
+  // comes during an iCache stall, so it sets fetchAtHalt.
+  bool step(bool snapshot, bool fetchAtHalt = false) {
+    bool halt = runOneCycle();
+    if (halt || snapshot) {
+      capturePipeState(halt && fetchAtHalt);
+    }
+    if (halt) {
+      return true;
     }
-    case 0x2b:
-    {
-      // store word
-      if (mostSig == 1) {
-          imm = imm | 0xffff0000;
+    latch();
+    cyclesElapsed = cyclesElapsed + 1;
+    return false;
+  }
+
+  /* START OF FAST-FORWARD */
+
+  // A load, store or fetch made by the functional engine: through the caches
+  // when warming them, without timing or hit counts, otherwise straight to
+  // memory
+  template <bool IsICache, bool IsRead, uint32_t Size>
+  void functionalAccess(uint32_t memAddress, uint32_t *data, uint32_t pc, bool warm)
+  {
+    if (!warm) {
+      if (IsRead) {
+        myMem->getMemValue(memAddress, *data, (MemEntrySize)Size);
+      } else {
+        myMem->setMemValue(memAddress, *data, (MemEntrySize)Size);
       }
-      uint32_t location = 0;
-      location = A + imm;
-      ex_mem.B = B;
-      ex_mem.ALUOut = location;
-      break;
+      return;
+    }
+    Cache* cache = IsICache ? &iCache : &dCache;
+    cache->now = warmCycles;
+    cache->pc = pc;
+    cache->access<IsRead, Size>(memAddress, data);
+    // Nothing is ever rolled back to before the detailed run
+    cache->commit();
+    if (l2Enabled) {
+      l2Cache.commit();
     }
   }
-  // Update pipeline registers
-  ex_mem.memRead = memRead;
-  ex_mem.memWrite = memWrite;
-  ex_mem.regWrite = regWrite;
-}
 
-// START OF MEM SECTION
-static void memSection() {
-  // Getting data about instruction
-  mem_wb.RD = ex_mem_cpy.RD;
-  mem_wb.ALUOut = ex_mem_cpy.ALUOut;
-  mem_wb.regWrite = ex_mem_cpy.regWrite;
-  mem_wb.IR = ex_mem_cpy.IR;
-
-  uint32_t storeData = 0;
-  uint32_t opcode = 0;
-  uint32_t func_code = 0;
-  bool memRead_mem = ex_mem_cpy.memRead;
-  bool memWrite_mem = ex_mem_cpy.memWrite;
-  bool regWrite = ex_mem_cpy.regWrite;
-
-  // Get the size to write to
-  uint32_t size = WORD_SIZE;
-  if (memRead_mem || memWrite_mem) {
-    opcode = mem_wb.IR >> 26;
-    func_code = mem_wb.IR  & (63);
-    switch (opcode) {
-      case 0x28:
-	{
-	  size = BYTE_SIZE;
-	  // store byte
-	  break;
-	}
-      case 0x29:
-	{
-	  size = HALF_SIZE;
-	  // store halfword
-	  break;
-	}
-      case 0x2b:
-	{
-	  size = WORD_SIZE;
-	  // store word
-	  break;
-	}
+  // Fetches and decodes the instruction at pc for the functional engine
+  MicroOp functionalFetch(uint32_t pc, bool warm)
+  {
+    uint32_t instruction = 0;
+    functionalAccess<ICACHE, READ, WORD_SIZE>(pc, &instruction, pc, warm);
+    return decode(pc, instruction);
+  }
 
+  // Applies what the pipeline would do for op, which is not a branch or
+  // jump, to the registers and memory. Returns false, having changed nothing,
+  // if it raises an exception.
+  bool functionalExecute(const MicroOp & op, bool warm)
+  {
+    if (!(op.control & UOP_VALID)) {
+      return false;
+    }
+    EXMEM out = EXMEM();
+    out.B = reg[op.RT];
+    if (!op.execute(reg[op.RS], reg[op.RT], op.operand, out)) {
+      return false;
+    }
+    uint32_t rd = (op.opcode == 0) ? op.RD : op.RT;
+    uint32_t *data = &out.ALUOut;
+    uint32_t loaded = 0;
+    switch (op.opcode) {
       case 0x24:
-	{
-	  // load byte unsigned
-	  size = BYTE_SIZE;
-	  break;
-	}
+        functionalAccess<DCACHE, READ, BYTE_SIZE>(out.ALUOut, &loaded, op.PC, warm);
+        data = &loaded;
+        break;
       case 0x25:
-	{
-	  size = HALF_SIZE;
-	  break;
-	}
+        functionalAccess<DCACHE, READ, HALF_SIZE>(out.ALUOut, &loaded, op.PC, warm);
+        data = &loaded;
+        break;
       case 0x23:
-        {
-          size = WORD_SIZE;
-          // load word
-          break;
-        }
+        functionalAccess<DCACHE, READ, WORD_SIZE>(out.ALUOut, &loaded, op.PC, warm);
+        data = &loaded;
+        break;
+      case 0x28:
+        functionalAccess<DCACHE, WRITE, BYTE_SIZE>(out.ALUOut, &out.B, op.PC, warm);
+        break;
+      case 0x29:
+        functionalAccess<DCACHE, WRITE, HALF_SIZE>(out.ALUOut, &out.B, op.PC, warm);
+        break;
+      case 0x2b:
+        functionalAccess<DCACHE, WRITE, WORD_SIZE>(out.ALUOut, &out.B, op.PC, warm);
+        break;
       default:
-         break;
-
+        break;
+    }
+    if (op.control & UOP_REG_WRITE) {
+      reg[rd] = *data;
     }
+    reg[0] = 0;
+    return true;
+  }
 
+  // Runs the instruction at PC, and the delay slot after a branch or jump,
+  // as the pipeline would but without timing them. Returns the number of
+  // instructions run: 0, leaving PC on it, at the halt or where the pipeline
+  // would raise an exception.
+  uint32_t functionalStep(bool warm)
+  {
+    uint32_t pc = PC;
+    MicroOp op = functionalFetch(pc, warm);
+    if (op.IR == 0xfeedfeed) {
+      return 0;
+    }
+    if (!(op.control & UOP_BRANCH)) {
+      if (!functionalExecute(op, warm)) {
+        return 0;
+      }
+      PC = pc + 4;
+      return 1;
+    }
+
+    // Branches compare, and jr reads, the registers from before the delay slot
+    uint32_t A = reg[op.RS];
+    uint32_t B = reg[op.RT];
+    uint32_t target = pc + 8;
+    uint32_t jump = ((pc + 4) & 0xf0000000) | ((op.IR << 6 >> 6) << 2);
+    bool taken = false;
+    switch (op.opcode) {
+      case 0x4: taken = (A == B); break;
+      case 0x5: taken = (A != B); break;
+      case 0x6: taken = (static_cast<int32_t>(A) <= 0); break;
+      case 0x7: taken = (static_cast<int32_t>(A) > 0); break;
+      case 0x2: target = jump; break;
+      case 0x3: target = jump; break;
+      case 0x0: target = A; break;
+      default: break;
+    }
+    if (taken) {
+      target = pc + 4 + (op.seimmed << 2);
+    }
+
+    MicroOp delay = functionalFetch(pc + 4, warm);
+    if (delay.IR == 0xfeedfeed || (delay.control & UOP_BRANCH)) {
+      return 0;
+    }
+    uint32_t ra = reg[31];
+    if (op.opcode == 0x3) {
+      reg[31] = pc + 8;
+    }
+    if (!functionalExecute(delay, warm)) {
+      reg[31] = ra;
+      return 0;
+    }
+    PC = target;
+    return 2;
   }
 
-  // Read from memory
-  if (memRead_mem) {
-    bool hit = cacheAccess(DCACHE, ex_mem_cpy.ALUOut, &storeData, READ, size);
-    if (!hit) {
-      dCache_stalls = (dCache_stalls <= dCache.missLatency) ? dCache.missLatency: dCache_stalls;
+  // FROM API: runs up to instructions instructions functionally before the
+  // pipeline starts, stopping early once stopPC is next
+  int fastForward(uint32_t instructions, uint32_t stopPC, bool warmCaches)
+  {
+    if (started) {
+      return -EINVAL;
+    }
+    uint32_t ran = 0;
+    while (ran < instructions && PC != stopPC) {
+      uint32_t n = functionalStep(warmCaches);
+      if (n == 0) {
+        break;
+      }
+      ran += n;
+      if (warmCaches) {
+        warmCycles += n;
+      }
     }
-    mem_wb.ALUOut = storeData;
+    // The pipeline starts empty, fetching from PC
+    PC_cpy = PC;
+    nPC = PC + WORD_SIZE;
+    fastForwarded += ran;
+    return ran;
   }
-  // Write to memory
-  if (memWrite_mem) {
-    bool hit = cacheAccess(DCACHE, ex_mem_cpy.ALUOut, &ex_mem_cpy.B, WRITE, size);
-    if (!hit) {
-      dCache_stalls = (dCache_stalls <= dCache.missLatency) ? dCache.missLatency: dCache_stalls;
+
+  /* END OF FAST-FORWARD */
+
+  // FROM API: run the specified number of cycles
+  int runCycles(uint32_t cycles) {
+    bool halt;
+    uint32_t endCycle = cyclesElapsed + cycles;
+    // If we're not running any cycles, just dump the most recent pipe state
+    if ((cycles == 0) || haltReached) {
+       dumpPipeState(mostRecentPS);
+       return (haltReached) ? 1 : 0;
+    }
+
+    // Run the correct number of cycles
+    while (cyclesElapsed < endCycle) {
+       // Stall cycles before the last one have nothing to dump
+       skipStall(endCycle - 1 - cyclesElapsed);
+       bool last = (cyclesElapsed == (endCycle - 1));
+       halt = step(last);
+
+       // If we need to dump pipe state, do so
+       if (halt || last) {
+           dumpPipeState(mostRecentPS);
+           if (halt) {
+              haltReached = true;
+              break;
+           }
+       }
     }
+
+    // Return if we reached a halt while running the specified number of cycles
+    return (halt) ? 1 : 0;
+
   }
-}
 
-// START OF WB SECTION (returns if halt has reached wb)
-static bool wbSection() {
-  // hardwire zero to ground
-  reg[0] = 0;
-  wb_instruction = mem_wb_cpy.IR;
+  // Sets up core id of a multicore run. Its program starts at address 0
+  // with $a0 holding id and $a1 the number of cores.
+  void initCore(uint32_t id, uint32_t cores, CacheConfig & icConfig, CacheConfig & dcConfig,
+                MemoryStore *mainMem) {
+    initSimulator(icConfig, dcConfig, mainMem);
+    // Peers change these caches behind the journal's back, and the cores
+    // run to their halts, so nothing is ever rolled back
+    iCache.journaling = false;
+    dCache.journaling = false;
+    coherent = true;
+    dCache.coreIndex = id;
+    reg[4] = id;
+    reg[5] = cores;
+  }
 
-  // If feedfeed is in wb, send halt through
-  if (mem_wb_cpy.IR == 0xfeedfeed) {
-    return true;
+  // Runs until cycle endCycle or the halt. Returns whether the core has
+  // halted.
+  bool runUntil(uint32_t endCycle) {
+    while (!haltReached && cyclesElapsed < endCycle) {
+      skipStall(endCycle - cyclesElapsed);
+      if (cyclesElapsed < endCycle) {
+        haltReached = step(false);
+      }
+    }
+    return haltReached;
   }
 
-  // Writes to register file
-  if (isRegWrite(wb_instruction >> 26, wb_instruction & (63))) {
-    reg[mem_wb_cpy.RD] = mem_wb_cpy.ALUOut;
+  // FROM API: runs until instructions more instructions have left ID, or
+  // the halt
+  int runInstructions(uint32_t instructions) {
+    uint32_t target = instructionsIssued + min(instructions, UINT32_MAX - instructionsIssued);
+    while (!haltReached && instructionsIssued < target) {
+      skipStall(UINT32_MAX);
+      haltReached = step(false);
+    }
+    return (haltReached) ? 1 : 0;
   }
 
-  // No 0xfeedfeed reached
-  return false;
-}
+  // FROM API: run until halt is reached
+  int runTillHalt() {
+     // run until we hit a halt
+     do {
+       skipStall(UINT32_MAX);
+     } while (!step(false, true));
 
-// Helper function that runs only one cycle
-static bool runOneCycle() {
-    // Corner case for calling runCycles(0);
-    started = true;
+     // Dump the pipe state after we've reached the halt (should be | nop | nop | nop | nop | HALT |)
+     dumpPipeState(mostRecentPS);
+     haltReached = true;
+     return 0;
+  }
+};
 
-    // If we are in a cache stall, update
-    if ((iCache_stalls > 0) || (dCache_stalls > 0)) {
-      iCache_stalls--;
-      dCache_stalls--;
-      if (iCache_stalls < 0) {
-        iCache_stalls = 0;
-      }
-      if (dCache_stalls < 0) {
-        dCache_stalls = 0;
-      }
+// Replaced by initSimulator, so every simulation starts from reset
+static Core *mainCore = new Core();
 
-      return false;
-    }
-    // Once out of cache stall, update cache with new values
-    if (iCache_stalls <= 0) {
-       mostRecentICache = iCache;
-    }
-    if (dCache_stalls <= 0) {
-       mostRecentDCache = dCache;
-    }
+/* START OF API */
 
-    // Forwarding Section
-    ex_fwd_A = 0;
-    ex_fwd_B = 0;
-    // EX Hazard (forward to EX)
-    if (ex_mem.regWrite && ((ex_mem.RD != 0) && (ex_mem.RD == id_ex.RS))) {
-      ex_fwd_A = 2;
-    }
-    if (ex_mem.regWrite && ((ex_mem.RD != 0) && (ex_mem.RD == id_ex.RT))) {
-      ex_fwd_B = 2;
-    }
-    // MEM Hazard (forward to EX)
-    if ((mem_wb.regWrite && (mem_wb.RD != 0)) && !(ex_mem.regWrite && ((ex_mem.RD != 0) && (ex_mem.RD == id_ex.RS))) && (mem_wb.RD == id_ex.RS)) {
-      ex_fwd_A = 1;
-    }
-    if ((mem_wb.regWrite && (mem_wb.RD != 0)) && !(ex_mem.regWrite && ((ex_mem.RD != 0) && (ex_mem.RD == id_ex.RT))) && (mem_wb.RD == id_ex.RT)) {
-      ex_fwd_B = 1;
-    }
+int setBlockTransfer(BlockReadFn read, BlockWriteFn write)
+{
+  blockRead = read ? read : wordBlockRead;
+  blockWrite = write ? write : wordBlockWrite;
+  return 0;
+}
 
-    // If we've hit an exception, squash the ID stage
-    if (hit_exception) {
-       if_id_cpy.IR = 0;
-       if_id_cpy.nPC = 0;
-    }
+int initSimulator(CacheConfig & icConfig, CacheConfig & dcConfig, MemoryStore *mainMem)
+{
+  delete mainCore;
+  mainCore = new Core();
+  return mainCore->initSimulator(icConfig, dcConfig, mainMem);
+}
 
-    // Run all sections backwards
-    bool halt = wbSection();
-    memSection();
-    exSection();
-    idSection();
-    ifSection();
+int traceAccesses(const char *path)
+{
+  return mainCore->traceAccesses(path);
+}
 
-    return halt;
+int initL2Cache(CacheConfig & l2Config)
+{
+  return mainCore->initL2Cache(l2Config);
 }
 
+int fastForward(uint32_t instructions, uint32_t stopPC, bool warmCaches)
+{
+  return mainCore->fastForward(instructions, stopPC, warmCaches);
+}
 
-// FROM API: run the specified number of cycles
-int runCycles(uint32_t cycles) {
-  bool halt;
-  uint32_t endCycle = cyclesElapsed + cycles;
-  // If we're not running any cycles, just dump the most recent pipe state
-  if ((cycles == 0) || haltReached) {
-     dumpPipeState(mostRecentPS);
-     return (haltReached) ? 1 : 0;
-  }
+int runCycles(uint32_t cycles)
+{
+  return mainCore->runCycles(cycles);
+}
 
-  // Run the correct number of cycles
-  while (cyclesElapsed < endCycle) {
-     // Run one cycle
-     halt = runOneCycle();
-
-     // If we need to dump pipe state, do so
-     if (halt || (cyclesElapsed ==  (endCycle - 1))) {
-         mostRecentPS.cycle = cyclesElapsed;
-         // If iCache stalled, need to pass 0xdeefdeef (UNKNOWN) into pipe state
-         if (iCache_stalls > 0) {
-           mostRecentPS.ifInstr = 0xdeefdeef;
-         }
-         else {
-           mostRecentPS.ifInstr = if_instruction;
-         }
-         mostRecentPS.idInstr = if_id_cpy.IR;
-         mostRecentPS.exInstr = id_ex_cpy.IR;
-         mostRecentPS.memInstr = ex_mem_cpy.IR;
-         mostRecentPS.wbInstr = mem_wb_cpy.IR;
-
-         dumpPipeState(mostRecentPS);
-         if (halt) {
-            haltReached = true;
-            break;
-         }
-     }
+int runInstructions(uint32_t instructions)
+{
+  return mainCore->runInstructions(instructions);
+}
 
-     // Update the copies if we aren't in a cache stall
-     if ((iCache_stalls <= 0) && (dCache_stalls <= 0)) {
-        if_id_cpy.nPC = if_id.nPC;
-        if_id_cpy.IR = if_id.IR;
-
-        id_ex_cpy.IR = id_ex.IR;
-        id_ex_cpy.opcode = id_ex.opcode;
-        id_ex_cpy.func_code = id_ex.func_code;
-        id_ex_cpy.nPC = id_ex.nPC;
-        id_ex_cpy.RS = id_ex.RS;
-        id_ex_cpy.RT = id_ex.RT;
-        id_ex_cpy.RD = id_ex.RD;
-        id_ex_cpy.immed = id_ex.immed;
-        id_ex_cpy.A = id_ex.A;
-        id_ex_cpy.B = id_ex.B;
-        id_ex_cpy.seimmed = id_ex.seimmed;
-        id_ex_cpy.shamt = id_ex.shamt;
-        id_ex_cpy.memRead = id_ex.memRead;
-        id_ex_cpy.regWrite = id_ex.regWrite;
-        id_ex_cpy.insertedNOP = id_ex.insertedNOP;
-
-        ex_mem_cpy.IR = ex_mem.IR;
-        ex_mem_cpy.BrTgt = ex_mem.BrTgt;
-        ex_mem_cpy.Zero = ex_mem.Zero;
-        ex_mem_cpy.ALUOut = ex_mem.ALUOut;
-        ex_mem_cpy.RD = ex_mem.RD;
-        ex_mem_cpy.B = ex_mem.B;
-        ex_mem_cpy.regWrite = ex_mem.regWrite;
-        ex_mem_cpy.memWrite = ex_mem.memWrite;
-        ex_mem_cpy.memRead = ex_mem.memRead;
-
-        mem_wb_cpy.IR = mem_wb.IR;
-        mem_wb_cpy.RD = mem_wb.RD;
-        mem_wb_cpy.memData = mem_wb.memData;
-        mem_wb_cpy.ALUOut = mem_wb.ALUOut;
-        mem_wb_cpy.regWrite = mem_wb.regWrite;
-     }
+int runTillHalt()
+{
+  return mainCore->runTillHalt();
+}
 
-    cyclesElapsed = cyclesElapsed + 1;
-  }
+int getSimulationStats(SimulationStats & stats)
+{
+  return mainCore->getSimulationStats(stats);
+}
 
-  // Return if we reached a halt while running the specified number of cycles
-  return (halt) ? 1 : 0;
+int finalizeSimulator()
+{
+  return mainCore->finalizeSimulator();
+}
+
+/* END OF API */
+
+/* START OF MULTICORE */
+
+#define MAX_CORES 8
+
+static vector<Core *> cores;
+
+// Meeting point at the end of each quantum. Every thread reports whether its
+// cores have all halted; wait() returns true once every core has.
+struct QuantumBarrier {
+  mutex lock;
+  condition_variable arrived;
+  uint32_t threads;
+  uint32_t waiting;
+  uint32_t generation;
+  bool allHalted;
+  bool lastAllHalted;
+
+  explicit QuantumBarrier(uint32_t n)
+      : threads(n), waiting(0), generation(0), allHalted(true), lastAllHalted(false) {}
+
+  bool wait(bool halted) {
+    unique_lock<mutex> l(lock);
+    allHalted = allHalted && halted;
+    uint32_t gen = generation;
+    if (++waiting == threads) {
+      lastAllHalted = allHalted;
+      allHalted = true;
+      waiting = 0;
+      generation++;
+      arrived.notify_all();
+    } else {
+      while (gen == generation) {
+        arrived.wait(l);
+      }
+    }
+    return lastAllHalted;
+  }
+};
 
+// Runs cores first, first + stride, ... one quantum at a time until every
+// core has halted
+static void runCoreGroup(uint32_t first, uint32_t stride, uint32_t quantum, QuantumBarrier *barrier)
+{
+  for (uint32_t end = quantum; ; end += quantum) {
+    bool halted = true;
+    for (uint32_t c = first; c < cores.size(); c += stride) {
+      halted = cores[c]->runUntil(end) && halted;
+    }
+    if (barrier->wait(halted)) {
+      return;
+    }
+  }
 }
 
-// FROM API: run until halt is reached
-int runTillHalt() {
-   bool halt = false;
-   // run until we hit a halt
-   while (true) {
-      halt = runOneCycle();
-
-      // If halt reached, break out
-      if (halt)
-         break;
-
-      // Update the copies if we aren't in a cache stall
-      if ((iCache_stalls <= 0) && (dCache_stalls <= 0)) {
-         if_id_cpy.nPC = if_id.nPC;
-         if_id_cpy.IR = if_id.IR;
-
-         id_ex_cpy.IR = id_ex.IR;
-         id_ex_cpy.opcode = id_ex.opcode;
-         id_ex_cpy.func_code = id_ex.func_code;
-         id_ex_cpy.nPC = id_ex.nPC;
-         id_ex_cpy.RS = id_ex.RS;
-         id_ex_cpy.RT = id_ex.RT;
-         id_ex_cpy.RD = id_ex.RD;
-         id_ex_cpy.immed = id_ex.immed;
-         id_ex_cpy.A = id_ex.A;
-         id_ex_cpy.B = id_ex.B;
-         id_ex_cpy.seimmed = id_ex.seimmed;
-         id_ex_cpy.shamt = id_ex.shamt;
-         id_ex_cpy.memRead = id_ex.memRead;
-         id_ex_cpy.regWrite = id_ex.regWrite;
-         id_ex_cpy.insertedNOP = id_ex.insertedNOP;
-
-         ex_mem_cpy.IR = ex_mem.IR;
-         ex_mem_cpy.BrTgt = ex_mem.BrTgt;
-         ex_mem_cpy.Zero = ex_mem.Zero;
-         ex_mem_cpy.ALUOut = ex_mem.ALUOut;
-         ex_mem_cpy.RD = ex_mem.RD;
-         ex_mem_cpy.B = ex_mem.B;
-         ex_mem_cpy.regWrite = ex_mem.regWrite;
-         ex_mem_cpy.memWrite = ex_mem.memWrite;
-         ex_mem_cpy.memRead = ex_mem.memRead;
-
-         mem_wb_cpy.IR = mem_wb.IR;
-         mem_wb_cpy.RD = mem_wb.RD;
-         mem_wb_cpy.memData = mem_wb.memData;
-         mem_wb_cpy.ALUOut = mem_wb.ALUOut;
-         mem_wb_cpy.regWrite = mem_wb.regWrite;
+int initMulticore(uint32_t nCores, CacheConfig & icConfig, CacheConfig & dcConfig, MemoryStore *mainMem)
+{
+  // The victim, stream and write buffers are not snooped
+  if (nCores < 2 || nCores > MAX_CORES || dcConfig.victimEntries || dcConfig.writeBufferEntries ||
+      dcConfig.prefetcher == PREFETCH_STREAM || checkCacheConfig(icConfig) || checkCacheConfig(dcConfig)) {
+    return -EINVAL;
+  }
+  for (uint32_t c = 0; c < cores.size(); c++) {
+    delete cores[c];
+  }
+  cores.clear();
+  for (uint32_t c = 0; c < nCores; c++) {
+    cores.push_back(new Core());
+    cores[c]->initCore(c, nCores, icConfig, dcConfig, mainMem);
+  }
+  for (uint32_t a = 0; a < nCores; a++) {
+    for (uint32_t b = 0; b < nCores; b++) {
+      if (a != b) {
+        cores[a]->dCache.addPeer(&cores[b]->dCache);
       }
+    }
+  }
+  return 0;
+}
 
-    cyclesElapsed = cyclesElapsed + 1;
-   }
-
-   // Dump the pipe state after we've reached the halt (should be | nop | nop | nop | nop | HALT |)
-   mostRecentPS.cycle = cyclesElapsed;
-   mostRecentPS.ifInstr = if_instruction;
-   mostRecentPS.idInstr = if_id_cpy.IR;
-   mostRecentPS.exInstr = id_ex_cpy.IR;
-   mostRecentPS.memInstr = ex_mem_cpy.IR;
-   mostRecentPS.wbInstr = mem_wb_cpy.IR;
-
-   dumpPipeState(mostRecentPS);
-   haltReached = true;
-   return 0;
+int runMulticoreTillHalt(uint32_t quantum, uint32_t threads)
+{
+  if (cores.empty()) {
+    return -EINVAL;
+  }
+  if (quantum == 0) {
+    quantum = 1;
+  }
+  if (threads == 0 || threads > cores.size()) {
+    threads = cores.size();
+  }
+  QuantumBarrier barrier(threads);
+  vector<thread> pool;
+  for (uint32_t t = 1; t < threads; t++) {
+    pool.push_back(thread(runCoreGroup, t, threads, quantum, &barrier));
+  }
+  runCoreGroup(0, threads, quantum, &barrier);
+  for (uint32_t t = 0; t < pool.size(); t++) {
+    pool[t].join();
+  }
+  return 0;
+}
+
+int finalizeMulticore()
+{
+  if (cores.empty()) {
+    return -EINVAL;
+  }
+  SimulationStats totals = SimulationStats();
+  ofstream caches("cache_stats.out");
+  ofstream state("core_state.out");
+  for (uint32_t c = 0; c < cores.size(); c++) {
+    Core *core = cores[c];
+    uint32_t cycles = core->started ? core->cyclesElapsed + 1 : 0;
+    totals.totalCycles = max(totals.totalCycles, cycles);
+    totals.icHits += core->icHits;
+    totals.icMisses += core->icMisses;
+    totals.dcHits += core->dcHits;
+    totals.dcMisses += core->dcMisses;
+
+    string name = "core " + to_string(c);
+    core->iCache.printStats(caches, (name + " iCache").c_str());
+    core->dCache.printStats(caches, (name + " dCache").c_str());
+    state << name << ": cycles: " << cycles << ", halted: " << core->haltReached << endl;
+    for (uint32_t r = 0; r < 32; r++) {
+      state << "  $" << dec << r << ": 0x" << hex << setw(8) << setfill('0') << core->reg[r]
+            << setfill(' ') << dec << endl;
+    }
+  }
+  printSimStats(totals);
+
+  for (uint32_t c = 0; c < cores.size(); c++) {
+    cores[c]->iCache.writeBackAll();
+    cores[c]->dCache.writeBackAll();
+  }
+  // reg_state.out holds core 0's registers, core_state.out every core's
+  cores[0]->dump(cores[0]->myMem, cores[0]->reg);
+  for (uint32_t c = 0; c < cores.size(); c++) {
+    delete cores[c];
+  }
+  cores.clear();
+  return 0;
 }
+
+/* END OF MULTICORE */
@@ -3,9 +3,14 @@
 #include <fstream>
 #include <string.h>
 #include <errno.h>
+#include <stdlib.h>
+#include <vector>
+#include <map>
+#include <algorithm>
 #include "MemoryStore.h"
 #include "RegisterInfo.h"
 #include "EndianHelpers.h"
+#include "AddressTrace.h"
 
 #define MAGIC_DEMARC 0xfeedfeed
 #define EXCEPTION_ADDR 0x8000
@@ -113,6 +118,27 @@ static MemoryStore *mem;
 static bool ll_sc_flag;
 static uint32_t ll_sc_addr;
 
+//Memory accesses are recorded here if a trace file was given. There are no
+//cycles in this simulator, so records carry the instruction count instead.
+static TraceWriter trace;
+static uint32_t instCount;
+//Address of the instruction being run. Loads and stores are traced with it, as
+//progCounter has already moved on to the target in a delay slot.
+static uint32_t instPC;
+
+//Basic-block vectors are written here if a file was given, in SimPoint's
+//format: a line per interval of bbvInterval instructions, counting the
+//instructions run in each basic block. A block runs until control leaves
+//straight-line order, and blocks are numbered from 1 as first entered.
+static ofstream bbvFile;
+static uint32_t bbvInterval;
+static uint32_t bbvNextBoundary;
+static uint32_t bbvBlockStart;
+static uint32_t bbvBlockInsts;
+static map<uint32_t, uint32_t> bbvIds;
+static vector<uint32_t> bbvCounts;
+static vector<uint32_t> bbvTouched;
+
 int initMemory(ifstream & inputProg)
 {
     if(inputProg && mem)
@@ -283,10 +309,20 @@ int handleOpZeroInst(uint32_t instr)
     return 0;
 }
 
+//Appends an access to the trace, if one is being recorded.
+void traceAccess(uint32_t addr, MemEntrySize size, bool isRead, bool isInst, uint32_t pc)
+{
+    if(trace.isOpen())
+    {
+        trace.record(addr, size, isRead, isInst, pc, instCount);
+    }
+}
+
 int doLoad(uint32_t addr, MemEntrySize size, uint8_t rt)
 {
     uint32_t value = 0;
     int ret = 0;
+    traceAccess(addr, size, true, false, instPC);
     ret = mem->getMemValue(addr, value, size);
     if(ret)
     {
@@ -428,6 +464,7 @@ int handleImmInst(uint32_t instr)
             regs[rt] = (regs[rs] < static_cast<uint32_t>(seImm)) ? 1 : 0;
             break;
         case OP_SB:
+            traceAccess(addr, BYTE_SIZE, false, false, instPC);
             ret = mem->setMemValue(addr, regs[rt] & 0xFF, BYTE_SIZE);
             checkLLSCOverlap(addr, BYTE_SIZE);
             break;
@@ -437,6 +474,7 @@ int handleImmInst(uint32_t instr)
                 if(ll_sc_flag)
                 {
                     //We are atomic. Store the value.
+                    traceAccess(addr, WORD_SIZE, false, false, instPC);
                     ret = mem->setMemValue(addr, regs[rt], WORD_SIZE);
                 }
 
@@ -449,10 +487,12 @@ int handleImmInst(uint32_t instr)
             ll_sc_flag = false;
             break;
         case OP_SH:
+            traceAccess(addr, HALF_SIZE, false, false, instPC);
             ret = mem->setMemValue(addr, regs[rt] & 0xFFFF, HALF_SIZE);
             checkLLSCOverlap(addr, HALF_SIZE);
             break;
         case OP_SW:
+            traceAccess(addr, WORD_SIZE, false, false, instPC);
             ret = mem->setMemValue(addr, regs[rt], WORD_SIZE);
             checkLLSCOverlap(addr, WORD_SIZE);
             break;
@@ -518,6 +558,9 @@ int runInstruction(uint32_t curInst, bool isDelayInst);
 int runDelayInstruction(uint32_t delayPC, int succRet)
 {
     uint32_t delayInst = 0;
+    instCount++;
+    traceAccess(delayPC, WORD_SIZE, true, true, delayPC);
+    instPC = delayPC;
     int ret = mem->getMemValue(delayPC, delayInst, WORD_SIZE);
     if(ret)
     {
@@ -660,6 +703,47 @@ void fillRegisterState(RegisterInfo & reg)
     reg.ra = regs[REG_RA];
 }
 
+//Credits the instructions run since the current block was entered to it,
+//and enters the next block at nextPC.
+void bbvEndBlock(uint32_t nextPC)
+{
+    uint32_t count = instCount - bbvBlockInsts;
+    if(count)
+    {
+        uint32_t & id = bbvIds[bbvBlockStart];
+        if(!id)
+        {
+            id = bbvCounts.size();
+            bbvCounts.push_back(0);
+        }
+        if(!bbvCounts[id])
+        {
+            bbvTouched.push_back(id);
+        }
+        bbvCounts[id] += count;
+    }
+    bbvBlockStart = nextPC;
+    bbvBlockInsts = instCount;
+}
+
+//Writes out the vector of the interval just finished and clears it.
+void bbvEndInterval()
+{
+    if(bbvTouched.empty())
+    {
+        return;
+    }
+    sort(bbvTouched.begin(), bbvTouched.end());
+    bbvFile << "T";
+    for(size_t i = 0 ; i < bbvTouched.size() ; i++)
+    {
+        bbvFile << ":" << bbvTouched[i] << ":" << bbvCounts[bbvTouched[i]] << " ";
+        bbvCounts[bbvTouched[i]] = 0;
+    }
+    bbvFile << "\n";
+    bbvTouched.clear();
+}
+
 //For delayed branches in combination with self-modifying code *shudder*, we should be
 //fine. Each instruction is fetched only once all previous instructions have finished
 //execution, so there should be no problem with stale values, etc.
@@ -671,6 +755,9 @@ int runProgram()
         //Store the current PC for printing out errors...
         uint32_t curPC = progCounter;
 
+        instCount++;
+        traceAccess(progCounter, WORD_SIZE, true, true, progCounter);
+        instPC = progCounter;
         if(mem->getMemValue(progCounter, curInst, WORD_SIZE))
         {
             return -EBADF;
@@ -693,6 +780,23 @@ int runProgram()
             return -EINVAL;
         }
 
+        if(bbvFile.is_open())
+        {
+            //A taken branch or jump, or an exception, ends the block
+            if(progCounter != curPC + WORD_SIZE)
+            {
+                bbvEndBlock(progCounter);
+            }
+            //A branch and its delay slot may cross the boundary together
+            if(instCount >= bbvNextBoundary)
+            {
+                //The block carries on into the next interval under the same id
+                bbvEndBlock(bbvBlockStart);
+                bbvEndInterval();
+                bbvNextBoundary += bbvInterval;
+            }
+        }
+
         //Dump the state of the system after every instruction for debugging purposes.
         //Commented out by default.
         /*cout << endl;
@@ -711,9 +815,9 @@ int runProgram()
 
 int main(int argc, char *argv[])
 {
-    if(argc != 2)
+    if(argc != 2 && argc != 3 && argc != 5)
     {
-        cout << "Usage: ./sim <file name>" << endl;
+        cout << "Usage: ./sim <file name> [trace file|-] [bbv file] [interval]" << endl;
         return -EINVAL;
     }
 
@@ -736,8 +840,43 @@ int main(int argc, char *argv[])
     //Run the program...
     progCounter = 0;
     ll_sc_flag = false;
+    instCount = 0;
+
+    if(argc >= 3 && strcmp(argv[2], "-") && trace.open(argv[2]))
+    {
+        cout << "Could not create trace file " << argv[2] << endl;
+    }
+
+    if(argc == 5)
+    {
+        bbvInterval = strtoul(argv[4], NULL, 0);
+        if(bbvInterval == 0)
+        {
+            cout << "The interval must be at least one instruction" << endl;
+            return -EINVAL;
+        }
+        bbvFile.open(argv[3]);
+        if(!bbvFile)
+        {
+            cout << "Could not create basic-block vector file " << argv[3] << endl;
+        }
+        bbvNextBoundary = bbvInterval;
+        bbvBlockStart = progCounter;
+        bbvBlockInsts = 0;
+        //Block ids start at 1
+        bbvCounts.assign(1, 0);
+    }
 
     runProgram();
+    trace.close();
+
+    if(bbvFile.is_open())
+    {
+        //The last interval, which may be short
+        bbvEndBlock(progCounter);
+        bbvEndInterval();
+        bbvFile.close();
+    }
 
     //Set the register values in the struct for printing...
     RegisterInfo reg;
@@ -3,6 +3,8 @@
 #include <fstream>
 #include <errno.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include "../src/MemoryStore.h"
 #include "../src/RegisterInfo.h"
 #include "../src/EndianHelpers.h"
@@ -44,11 +46,53 @@ int initMemory(ifstream & inputProg)
     return 0;
 }
 
+//Replays a binary trace through the caches and reports how fast it went.
+int replay(const char *path)
+{
+    mem = createMemoryStore();
+
+    CacheConfig icConfig;
+    icConfig.cacheSize = 1024;
+    icConfig.blockSize = 64;
+    icConfig.type = DIRECT_MAPPED;
+    icConfig.missLatency = 5;
+    CacheConfig dcConfig = icConfig;
+
+    initSimulator(icConfig, dcConfig, mem);
+    clock_t start = clock();
+    int replayed = replayTrace(path);
+    double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+    if(replayed < 0)
+    {
+        cout << "Could not read trace " << path << endl;
+        delete mem;
+        return replayed;
+    }
+
+    printStats();
+    cout << "Replayed " << dec << replayed << " accesses in " << seconds << "s";
+    if(seconds > 0)
+    {
+        cout << " (" << replayed / seconds / 1e6 << "M accesses/s)";
+    }
+    cout << endl;
+
+    finalizeSimulator();
+    delete mem;
+    return 0;
+}
+
 int main(int argc, char **argv)
 {
+    if(argc == 3 && strcmp(argv[1], "-t") == 0)
+    {
+        return replay(argv[2]);
+    }
+
     if(argc != 2)
     {
         cout << "Usage: ./cache_sim <file name>" << endl;
+        cout << "       ./cache_sim -t <trace file>" << endl;
         return -EINVAL;
     }
 
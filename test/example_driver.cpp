@@ -44,9 +44,9 @@ int initMemory(ifstream & inputProg)
 
 int main(int argc, char **argv)
 {
-    if(argc != 2)
+    if(argc != 2 && argc != 3)
     {
-        cout << "Usage: ./cycle_sim <file name>" << endl;
+        cout << "Usage: ./cycle_sim <file name> [trace file]" << endl;
         return -EINVAL;
     }
 
@@ -68,6 +68,10 @@ int main(int argc, char **argv)
     CacheConfig dcConfig = icConfig;
 
     initSimulator(icConfig, dcConfig, mem);
+    if(argc == 3 && traceAccesses(argv[2]))
+    {
+        cout << "Could not create trace file " << argv[2] << endl;
+    }
 
     runCycles(30);
     finalizeSimulator();
@@ -0,0 +1,87 @@
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <errno.h>
+#include <stdlib.h>
+#include "../src/MemoryStore.h"
+#include "../src/RegisterInfo.h"
+#include "../src/EndianHelpers.h"
+#include "../src/DriverFunctions.h"
+
+using namespace std;
+
+static MemoryStore *mem;
+
+int initMemory(ifstream & inputProg)
+{
+    if(inputProg && mem)
+    {
+        uint32_t curVal = 0;
+        uint32_t addr = 0;
+
+        while(inputProg.read((char *)(&curVal), sizeof(uint32_t)))
+        {
+            curVal = ConvertWordToBigEndian(curVal);
+            int ret = mem->setMemValue(addr, curVal, WORD_SIZE);
+
+            if(ret)
+            {
+                cout << "Could not set memory value!" << endl;
+                return -EINVAL;
+            }
+
+            //We're reading 4 bytes each time...
+            addr += 4;
+        }
+    }
+    else
+    {
+        cout << "Invalid file stream or memory image passed, could not initialise memory values" << endl;
+        return -EINVAL;
+    }
+
+    return 0;
+}
+
+//Fast-forwards through the start of a program functionally, then simulates
+//the rest cycle by cycle. stop pc ends the fast-forward early (as hex, e.g.
+//0x40); warm is 1 to run the fast-forward through the caches.
+int main(int argc, char **argv)
+{
+    if(argc < 3 || argc > 5)
+    {
+        cout << "Usage: ./fastforward_sim <file name> <instructions> [stop pc] [warm]" << endl;
+        return -EINVAL;
+    }
+
+    ifstream prog;
+    prog.open(argv[1], ios::binary | ios::in);
+
+    mem = createMemoryStore();
+
+    if(initMemory(prog))
+    {
+        return -EBADF;
+    }
+
+    CacheConfig icConfig;
+    icConfig.cacheSize = 1024;
+    icConfig.blockSize = 64;
+    icConfig.type = DIRECT_MAPPED;
+    icConfig.missLatency = 5;
+    CacheConfig dcConfig = icConfig;
+
+    uint32_t instructions = strtoul(argv[2], NULL, 0);
+    uint32_t stopPC = (argc > 3) ? strtoul(argv[3], NULL, 0) : 0xffffffff;
+    bool warm = (argc > 4) && atoi(argv[4]);
+
+    initSimulator(icConfig, dcConfig, mem);
+    int ran = fastForward(instructions, stopPC, warm);
+    cout << "Fast-forwarded " << ran << " instructions" << endl;
+
+    runTillHalt();
+    finalizeSimulator();
+
+    delete mem;
+    return 0;
+}
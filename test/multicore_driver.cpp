@@ -0,0 +1,93 @@
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <chrono>
+#include <errno.h>
+#include <stdlib.h>
+#include "../src/MemoryStore.h"
+#include "../src/RegisterInfo.h"
+#include "../src/EndianHelpers.h"
+#include "../src/DriverFunctions.h"
+
+using namespace std;
+
+static MemoryStore *mem;
+
+int initMemory(ifstream & inputProg)
+{
+    if(inputProg && mem)
+    {
+        uint32_t curVal = 0;
+        uint32_t addr = 0;
+
+        while(inputProg.read((char *)(&curVal), sizeof(uint32_t)))
+        {
+            curVal = ConvertWordToBigEndian(curVal);
+            int ret = mem->setMemValue(addr, curVal, WORD_SIZE);
+
+            if(ret)
+            {
+                cout << "Could not set memory value!" << endl;
+                return -EINVAL;
+            }
+
+            //We're reading 4 bytes each time...
+            addr += 4;
+        }
+    }
+    else
+    {
+        cout << "Invalid file stream or memory image passed, could not initialise memory values" << endl;
+        return -EINVAL;
+    }
+
+    return 0;
+}
+
+//Runs one program on several cores sharing memory. Each core starts at
+//address 0 with its core number in $a0 and the number of cores in $a1. The
+//host time of the run is printed, for comparing thread counts (see
+//multicore_scaling.asm).
+int main(int argc, char **argv)
+{
+    if(argc < 3 || argc > 5)
+    {
+        cout << "Usage: ./multicore_sim <file name> <cores> [quantum] [threads]" << endl;
+        return -EINVAL;
+    }
+
+    ifstream prog;
+    prog.open(argv[1], ios::binary | ios::in);
+
+    mem = createMemoryStore();
+
+    if(initMemory(prog))
+    {
+        return -EBADF;
+    }
+
+    CacheConfig icConfig;
+    icConfig.cacheSize = 1024;
+    icConfig.blockSize = 64;
+    icConfig.type = DIRECT_MAPPED;
+    icConfig.missLatency = 5;
+    CacheConfig dcConfig = icConfig;
+
+    uint32_t cores = atoi(argv[2]);
+    uint32_t quantum = (argc > 3) ? atoi(argv[3]) : 100;
+    uint32_t threads = (argc > 4) ? atoi(argv[4]) : 1;
+    if(initMulticore(cores, icConfig, dcConfig, mem))
+    {
+        cout << "Cannot simulate " << argv[2] << " cores" << endl;
+        return -EINVAL;
+    }
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    runMulticoreTillHalt(quantum, threads);
+    chrono::duration<double, milli> elapsed = chrono::steady_clock::now() - start;
+    cout << "Simulated " << cores << " cores on " << threads << " threads in " << elapsed.count() << " ms" << endl;
+    finalizeMulticore();
+
+    delete mem;
+    return 0;
+}
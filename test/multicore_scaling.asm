@@ -0,0 +1,24 @@
+# Multicore scaling benchmark: every core sums into the 16 words of its own
+# 2 KB-apart region, so after the first pass its dCache holds the block
+# Modified and its accesses hit without going over the bus. Time
+# ./multicore_sim with 1 host thread and with 8 to see the pool's speedup.
+.set noreorder
+sll $t0, $a0, 11
+li $t1, 0x4000
+add $t1, $t1, $t0
+addi $s1, $zero, 3000
+pass:
+addi $t2, $zero, 16
+add $t3, $t1, $zero
+word:
+lw $t4, 0($t3)
+add $t4, $t4, $t2
+sw $t4, 0($t3)
+addi $t3, $t3, 4
+addi $t2, $t2, -1
+bgtz $t2, word
+nop
+addi $s1, $s1, -1
+bgtz $s1, pass
+nop
+.word 0xfeedfeed
@@ -0,0 +1,178 @@
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <vector>
+#include <errno.h>
+#include <stdlib.h>
+#include "../src/MemoryStore.h"
+#include "../src/RegisterInfo.h"
+#include "../src/EndianHelpers.h"
+#include "../src/DriverFunctions.h"
+#include "../src/SimPoint.h"
+
+using namespace std;
+
+//Picks simulation points from the basic-block vectors of a profiling run
+//(./sim <file name> - <bbv file> <interval>), writing them to simpoints.out
+//and their weights to weights.out in SimPoint's format. Given the program as
+//well, it then simulates only those intervals in cycle_sim, each after a
+//fast-forward that warms the caches, and combines them into whole-program
+//CPI and miss rate estimates in simpoint_stats.out.
+
+//Seed for the projection and k-means starts
+static const uint32_t seed = 1;
+
+int initMemory(ifstream & inputProg, MemoryStore *mem)
+{
+    if(inputProg && mem)
+    {
+        uint32_t curVal = 0;
+        uint32_t addr = 0;
+
+        while(inputProg.read((char *)(&curVal), sizeof(uint32_t)))
+        {
+            curVal = ConvertWordToBigEndian(curVal);
+            int ret = mem->setMemValue(addr, curVal, WORD_SIZE);
+
+            if(ret)
+            {
+                cout << "Could not set memory value!" << endl;
+                return -EINVAL;
+            }
+
+            //We're reading 4 bytes each time...
+            addr += 4;
+        }
+    }
+    else
+    {
+        cout << "Invalid file stream or memory image passed, could not initialise memory values" << endl;
+        return -EINVAL;
+    }
+
+    return 0;
+}
+
+static double ratio(double part, double whole)
+{
+    return whole ? part / whole : 0.0;
+}
+
+int main(int argc, char **argv)
+{
+    if(argc < 3 || argc > 5)
+    {
+        cout << "Usage: ./simpoint_sim <bbv file> <interval> [max k] [file name]" << endl;
+        return -EINVAL;
+    }
+
+    vector<BasicBlockVector> bbvs;
+    int ret = loadBBVs(argv[1], bbvs);
+    if(ret || bbvs.empty())
+    {
+        cout << "Could not read basic-block vectors from " << argv[1] << endl;
+        return ret ? ret : -EINVAL;
+    }
+    uint32_t interval = strtoul(argv[2], NULL, 0);
+    uint32_t maxK = (argc > 3) ? strtoul(argv[3], NULL, 0) : 10;
+    if(interval == 0)
+    {
+        cout << "The interval must be at least one instruction" << endl;
+        return -EINVAL;
+    }
+
+    vector<SimPoint> simPoints = pickSimPoints(bbvs, maxK, seed);
+    ofstream pointsOut("simpoints.out");
+    ofstream weightsOut("weights.out");
+    for(uint32_t i = 0; i < simPoints.size(); i++)
+    {
+        pointsOut << simPoints[i].interval << " " << simPoints[i].cluster << endl;
+        weightsOut << simPoints[i].weight << " " << simPoints[i].cluster << endl;
+    }
+    cout << "Picked " << simPoints.size() << " simulation points from " << bbvs.size() << " intervals" << endl;
+    if(argc < 5)
+    {
+        return 0;
+    }
+
+    uint64_t programInstructions = 0;
+    for(uint32_t i = 0; i < bbvs.size(); i++)
+    {
+        programInstructions += bbvInstructions(bbvs[i]);
+    }
+
+    CacheConfig icConfig;
+    icConfig.cacheSize = 1024;
+    icConfig.blockSize = 64;
+    icConfig.type = DIRECT_MAPPED;
+    icConfig.missLatency = 5;
+    CacheConfig dcConfig = icConfig;
+
+    ofstream stats("simpoint_stats.out");
+    stats << "interval,weight,instructions,cycles,cpi,icMissRate,dcMissRate" << endl;
+    //Weighted sums of each point's cycles, accesses and misses per instruction
+    double weights = 0;
+    double cpi = 0;
+    double icAccesses = 0;
+    double icMisses = 0;
+    double dcAccesses = 0;
+    double dcMisses = 0;
+    for(uint32_t i = 0; i < simPoints.size(); i++)
+    {
+        const SimPoint & point = simPoints[i];
+        MemoryStore *mem = createMemoryStore();
+        ifstream prog;
+        prog.open(argv[4], ios::binary | ios::in);
+        if(initMemory(prog, mem))
+        {
+            delete mem;
+            return -EBADF;
+        }
+
+        //Every point starts from a fresh simulator and memory image
+        initSimulator(icConfig, dcConfig, mem);
+        uint32_t start = point.interval * interval;
+        int ran = fastForward(start, 0xffffffff, true);
+        uint32_t length = bbvInstructions(bbvs[point.interval]);
+        runInstructions(length);
+        SimulationStats s;
+        getSimulationStats(s);
+        delete mem;
+
+        //The functional simulators part ways at exceptions, so a point the
+        //fast-forward cannot reach is left out and the rest reweighted
+        if(ran < 0 || (uint32_t)ran < start || s.instructions == 0)
+        {
+            cout << "Interval " << point.interval << " could not be reached, skipping it" << endl;
+            continue;
+        }
+
+        double pointCPI = ratio(s.totalCycles, s.instructions);
+        double pointIC = ratio(s.icMisses, s.icHits + s.icMisses);
+        double pointDC = ratio(s.dcMisses, s.dcHits + s.dcMisses);
+        stats << point.interval << "," << point.weight << "," << s.instructions << "," << s.totalCycles << ","
+              << pointCPI << "," << pointIC << "," << pointDC << endl;
+        weights += point.weight;
+        cpi += point.weight * pointCPI;
+        icAccesses += point.weight * ratio(s.icHits + s.icMisses, s.instructions);
+        icMisses += point.weight * ratio(s.icMisses, s.instructions);
+        dcAccesses += point.weight * ratio(s.dcHits + s.dcMisses, s.instructions);
+        dcMisses += point.weight * ratio(s.dcMisses, s.instructions);
+    }
+    if(weights == 0)
+    {
+        cout << "No simulation point could be simulated" << endl;
+        return -EINVAL;
+    }
+
+    cpi /= weights;
+    double icMissRate = ratio(icMisses, icAccesses);
+    double dcMissRate = ratio(dcMisses, dcAccesses);
+    stats << "Estimated CPI: " << cpi << endl;
+    stats << "Estimated cycles: " << (uint64_t)(cpi * programInstructions) << endl;
+    stats << "Estimated iCache miss rate: " << icMissRate << endl;
+    stats << "Estimated dCache miss rate: " << dcMissRate << endl;
+    cout << "Estimated CPI " << cpi << " over " << programInstructions << " instructions, iCache miss rate "
+         << icMissRate << ", dCache miss rate " << dcMissRate << endl;
+    return 0;
+}
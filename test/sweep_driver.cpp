@@ -0,0 +1,164 @@
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <errno.h>
+#include <stdlib.h>
+#include "../src/MemoryStore.h"
+#include "../src/DriverFunctions.h"
+#include "../src/cache_test.h"
+
+using namespace std;
+
+//Design-space sweep: replays one recorded address trace (see traceAccesses in
+//cycle_sim, or ./sim <file name> <trace file>) through every configuration in
+//the grid below, spread over a pool of threads. The trace is loaded once and
+//shared read-only; each worker has its own caches and memory.
+
+static const uint32_t cacheSizes[] = {256, 512, 1024, 2048, 4096, 8192, 16384};
+static const uint32_t blockSizes[] = {4, 8, 16, 32, 64};
+static const CacheType types[] = {DIRECT_MAPPED, TWO_WAY_SET_ASSOC, N_WAY_SET_ASSOC, FULLY_ASSOC};
+//Ways used for N_WAY_SET_ASSOC
+static const uint32_t nWays = 4;
+static const uint32_t missLatencies[] = {5, 10, 20, 50};
+
+#define COUNT(a) (sizeof(a) / sizeof((a)[0]))
+
+struct SweepPoint
+{
+    CacheConfig config;
+    uint32_t icHits;
+    uint32_t icMisses;
+    uint32_t dcHits;
+    uint32_t dcMisses;
+};
+
+static const char *typeName(CacheType type)
+{
+    switch(type)
+    {
+        case DIRECT_MAPPED:
+            return "direct";
+        case TWO_WAY_SET_ASSOC:
+            return "2-way";
+        case N_WAY_SET_ASSOC:
+            return "4-way";
+        case FULLY_ASSOC:
+            return "fully";
+    }
+    return "unknown";
+}
+
+//Estimated cycles on a blocking pipeline issuing one instruction per cycle,
+//ignoring hazards: one cycle per fetch plus the pipeline fill, and the miss
+//latency for every miss in either cache.
+static uint64_t estimatedCycles(const SweepPoint & p, uint32_t missLatency)
+{
+    uint64_t fetches = p.icHits + p.icMisses;
+    return fetches + 4 + (uint64_t)(p.icMisses + p.dcMisses) * missLatency;
+}
+
+//Worker loop: claims grid points until there are none left
+static void sweepWorker(const vector<TraceRecord> & trace, vector<SweepPoint> & points, atomic<uint32_t> & next)
+{
+    MemoryStore *mem = createMemoryStore();
+    CacheSimulator sim;
+    uint32_t i;
+    while((i = next++) < points.size())
+    {
+        CacheConfig config = points[i].config;
+        sim.init(config, config, mem);
+        sim.replay(&trace[0], trace.size());
+        points[i].icHits = sim.icHits;
+        points[i].icMisses = sim.icMisses;
+        points[i].dcHits = sim.dcHits;
+        points[i].dcMisses = sim.dcMisses;
+    }
+    delete mem;
+}
+
+int main(int argc, char **argv)
+{
+    if(argc != 2 && argc != 3)
+    {
+        cout << "Usage: ./sweep_sim <trace file> [threads]" << endl;
+        return -EINVAL;
+    }
+
+    vector<TraceRecord> trace;
+    int ret = loadTrace(argv[1], trace);
+    if(ret || trace.empty())
+    {
+        cout << "Could not read trace " << argv[1] << endl;
+        return ret ? ret : -EINVAL;
+    }
+
+    //The miss latency only changes the cycle estimate, so each cache shape is
+    //simulated once
+    vector<SweepPoint> points;
+    for(uint32_t s = 0; s < COUNT(cacheSizes); s++)
+    {
+        for(uint32_t b = 0; b < COUNT(blockSizes); b++)
+        {
+            for(uint32_t t = 0; t < COUNT(types); t++)
+            {
+                SweepPoint p = SweepPoint();
+                p.config.cacheSize = cacheSizes[s];
+                p.config.blockSize = blockSizes[b];
+                p.config.type = types[t];
+                p.config.associativity = nWays;
+                p.config.missLatency = missLatencies[0];
+                if(cacheWays(p.config) * blockSizes[b] > cacheSizes[s])
+                {
+                    continue;
+                }
+                points.push_back(p);
+            }
+        }
+    }
+
+    uint32_t threads = (argc == 3) ? atoi(argv[2]) : thread::hardware_concurrency();
+    if(threads == 0)
+    {
+        threads = 1;
+    }
+    atomic<uint32_t> next(0);
+    vector<thread> pool;
+    for(uint32_t t = 0; t < threads; t++)
+    {
+        pool.push_back(thread(sweepWorker, cref(trace), ref(points), ref(next)));
+    }
+    for(uint32_t t = 0; t < threads; t++)
+    {
+        pool[t].join();
+    }
+
+    ofstream csv("sweep.csv");
+    ofstream json("sweep.json");
+    csv << "cacheSize,blockSize,type,missLatency,icHits,icMisses,dcHits,dcMisses,estimatedCycles" << endl;
+    json << "[";
+    bool first = true;
+    for(uint32_t i = 0; i < points.size(); i++)
+    {
+        const SweepPoint & p = points[i];
+        for(uint32_t l = 0; l < COUNT(missLatencies); l++)
+        {
+            uint64_t cycles = estimatedCycles(p, missLatencies[l]);
+            csv << p.config.cacheSize << "," << p.config.blockSize << "," << typeName(p.config.type) << ","
+                << missLatencies[l] << "," << p.icHits << "," << p.icMisses << "," << p.dcHits << ","
+                << p.dcMisses << "," << cycles << endl;
+            json << (first ? "\n" : ",\n") << "  {\"cacheSize\": " << p.config.cacheSize
+                 << ", \"blockSize\": " << p.config.blockSize << ", \"type\": \"" << typeName(p.config.type)
+                 << "\", \"missLatency\": " << missLatencies[l] << ", \"icHits\": " << p.icHits
+                 << ", \"icMisses\": " << p.icMisses << ", \"dcHits\": " << p.dcHits
+                 << ", \"dcMisses\": " << p.dcMisses << ", \"estimatedCycles\": " << cycles << "}";
+            first = false;
+        }
+    }
+    json << "\n]" << endl;
+
+    cout << "Swept " << points.size() * COUNT(missLatencies) << " configurations over "
+         << trace.size() << " accesses on " << threads << " threads" << endl;
+    return 0;
+}